@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# Copyright 2024 KazaWai.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+
+"""
+Client of the sigmf_writer control channel (is_loopback mode).
+
+    lora_control.py 12                 # record device 12 from the next call
+    lora_control.py 12 --at 5000000    # ... starting exactly at sample 5000000
+    lora_control.py --position         # samples recorded so far
+    lora_control.py --close            # finish the recordings
+"""
+
+import argparse
+import socket
+import sys
+
+
+def send(host, port, command, timeout):
+    with socket.create_connection((host, port), timeout=timeout) as sock:
+        sock.sendall((command + "\n").encode("utf-8"))
+        return sock.recv(1024).decode("utf-8").strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device_id", nargs="?", type=int,
+                        help="Device id of the next recording")
+    parser.add_argument("--at", type=int, default=None,
+                        help="First sample of the new recording")
+    parser.add_argument("--position", action="store_true",
+                        help="Print the number of samples recorded")
+    parser.add_argument("--close", action="store_true",
+                        help="Finish the recordings and stop the flowgraph")
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=12345)
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    if args.close:
+        command = "close"
+    elif args.position:
+        command = "position"
+    elif args.device_id is not None:
+        command = str(args.device_id)
+        if args.at is not None:
+            command += f" {args.at}"
+    else:
+        parser.error("a device id, --position or --close is required")
+
+    reply = send(args.host, args.port, command, args.timeout)
+    print(reply)
+    return 0 if reply not in ("ERR", "BUSY") else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
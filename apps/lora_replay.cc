@@ -0,0 +1,438 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Offline detector over SigMF recordings, without a flowgraph.
+ *
+ * Every .sigmf-data file is memory-mapped and cut into chunks that overlap
+ * by the 13 symbols history (plus a margin), and the chunks are searched in
+ * parallel with the sync state machine of lora_detector. Detections go to
+ * stdout (or --output) as CSV or JSON lines, the throughput report to
+ * stderr:
+ *
+ *   lora_replay --sf 7 --threads 0 capture_input0.sigmf-data > det.csv
+ */
+
+#include "dechirp_engine.h"
+#include "polyphase_resampler.h"
+#include "sigmf_meta.h"
+#include "sync_detector.h"
+#include "worker_pool.h"
+
+#include <gnuradio/first_lora/log.h>
+#include <gnuradio/gr_complex.h>
+#include <volk/volk.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace gr::first_lora;
+
+namespace {
+
+struct options {
+  int sf = 7;
+  uint32_t bw = 125000;
+  uint32_t rate = 0; // 0: from the metadata, else 2x the bandwidth
+  int method = 1;
+  int padding = PEAK_RESOLUTION;
+  int peaks = 1; // Candidate preambles per symbol, see sync_detector
+  int threads = 0;
+  uint64_t chunk_symbols = 4096; // Symbols searched per chunk
+  std::string output;
+  bool json = false;
+  std::vector<std::string> files;
+};
+
+struct detection {
+  uint64_t sample; // First sample of the 13 symbols window
+  uint32_t length; // Window length in samples
+};
+
+/**
+ * @brief A memory-mapped recording and what its metadata says about it
+ */
+struct recording {
+  std::string path;
+  const void *data = nullptr;
+  size_t bytes = 0;
+  bool ci16 = false;  // ci16_le samples, else cf32_le
+  uint32_t rate = 0;  // core:sample_rate, 0 if unknown
+  uint64_t samples = 0;
+
+  ~recording() {
+    if (data != nullptr) {
+      munmap((void *)data, bytes);
+    }
+  }
+};
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--sf SF] [--bw HZ] [--rate HZ] [--method 1|3] "
+          "[--padding P] [--peaks K] [--threads N] [--chunk SYMBOLS] "
+          "[--output FILE] [--format csv|json] FILE.sigmf-data...\n",
+          prog);
+}
+
+bool parse_args(int argc, char **argv, options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      opt.files.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string val = argv[++i];
+    if (arg == "--sf") {
+      opt.sf = std::stoi(val);
+    } else if (arg == "--bw") {
+      opt.bw = std::stoul(val);
+    } else if (arg == "--rate") {
+      opt.rate = std::stoul(val);
+    } else if (arg == "--method") {
+      opt.method = std::stoi(val);
+    } else if (arg == "--padding") {
+      opt.padding = std::stoi(val);
+    } else if (arg == "--peaks") {
+      opt.peaks = std::stoi(val);
+    } else if (arg == "--threads") {
+      opt.threads = std::stoi(val);
+    } else if (arg == "--chunk") {
+      opt.chunk_symbols = std::stoull(val);
+    } else if (arg == "--output") {
+      opt.output = val;
+    } else if (arg == "--format") {
+      opt.json = val == "json";
+    } else {
+      return false;
+    }
+  }
+  return opt.sf >= 6 && opt.sf <= 12 && (opt.method == 1 || opt.method == 3) &&
+         opt.padding >= 1 && opt.peaks >= 1 && opt.peaks <= MAX_PEAKS &&
+         opt.chunk_symbols >= 1 && !opt.files.empty();
+}
+
+/**
+ * @brief Value of a top level "key": value pair of a SigMF metadata file
+ *
+ * Enough for the core:datatype and core:sample_rate fields, not a JSON
+ * parser.
+ */
+std::string meta_value(const std::string &json, const std::string &key) {
+  const std::string quoted = "\"" + key + "\"";
+  size_t k = json.find(quoted);
+  if (k == std::string::npos) {
+    return "";
+  }
+  size_t v = json.find(':', k + quoted.size());
+  if (v == std::string::npos) {
+    return "";
+  }
+  v = json.find_first_not_of(" \t\r\n\"", v + 1);
+  size_t end = json.find_first_of(",}\"\r\n", v);
+  return v == std::string::npos ? "" : json.substr(v, end - v);
+}
+
+/**
+ * @brief Field of a CSV line, quoted when it holds a comma, a quote or a
+ * line break (RFC 4180)
+ */
+std::string csv_field(const std::string &s) {
+  if (s.find_first_of(",\"\r\n") == std::string::npos) {
+    return s;
+  }
+  std::string out = "\"";
+  for (char c : s) {
+    out += c;
+    if (c == '"') {
+      out += '"';
+    }
+  }
+  return out + "\"";
+}
+
+bool open_recording(const std::string &path, recording &rec) {
+  rec.path = path;
+
+  // Metadata next to the data file, if any
+  std::string base = path;
+  size_t ext = base.rfind(".sigmf-data");
+  if (ext != std::string::npos) {
+    base.erase(ext);
+  }
+  std::ifstream meta(base + ".sigmf-meta");
+  if (meta) {
+    std::stringstream ss;
+    ss << meta.rdbuf();
+    std::string datatype = meta_value(ss.str(), "core:datatype");
+    std::string rate = meta_value(ss.str(), "core:sample_rate");
+    if (!datatype.empty() && datatype != "cf32_le" && datatype != "ci16_le") {
+      fprintf(stderr, "%s: unsupported datatype %s\n", path.c_str(),
+              datatype.c_str());
+      return false;
+    }
+    rec.ci16 = datatype == "ci16_le";
+    rec.rate = rate.empty() ? 0 : (uint32_t)std::stod(rate);
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path.c_str());
+    close(fd);
+    return false;
+  }
+  rec.bytes = st.st_size;
+  if (rec.bytes > 0) {
+    void *p = mmap(NULL, rec.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      perror(path.c_str());
+      close(fd);
+      return false;
+    }
+    // Every chunk is read once, front to back
+    madvise(p, rec.bytes, MADV_SEQUENTIAL);
+    rec.data = p;
+  }
+  close(fd);
+  rec.samples = rec.bytes / (rec.ci16 ? 2 * sizeof(int16_t) : sizeof(gr_complex));
+  return true;
+}
+
+/**
+ * @brief Search one chunk of a recording
+ *
+ * The chunk owns the windows starting in [begin, end). It is read from
+ * lead samples before begin so the state machine has seen the whole
+ * preamble of the first windows it owns, and up to a packet after end.
+ */
+void scan_chunk(const options &opt, const recording &rec, uint32_t rate,
+                uint64_t begin, uint64_t end, uint64_t lead, uint64_t tail,
+                std::vector<detection> &hits) {
+  const uint64_t from = begin > lead ? begin - lead : 0;
+  const uint64_t to = std::min(end + tail, rec.samples);
+  const size_t n = to - from;
+
+  // Samples as cf32, converted when the recording is ci16
+  std::vector<gr_complex> converted;
+  const gr_complex *x;
+  if (rec.ci16) {
+    converted.resize(n);
+    volk_16i_s32f_convert_32f((float *)converted.data(),
+                              (const int16_t *)rec.data + 2 * from, SC16_SCALE,
+                              2 * n);
+    x = converted.data();
+  } else {
+    x = (const gr_complex *)rec.data + from;
+  }
+
+  // Same front end as lora_detector: 2x the bandwidth as is, anything else
+  // resampled to 1x
+  std::unique_ptr<polyphase_resampler> resampler;
+  uint32_t sync_fs = rate;
+  if (rate != 2 * opt.bw) {
+    resampler = std::make_unique<polyphase_resampler>(rate, opt.bw);
+    sync_fs = opt.bw;
+  }
+  sync_detector sync(opt.sf, opt.bw, sync_fs, opt.padding, opt.peaks);
+  if (opt.method == 3) {
+    sync.engine().set_peak_method(peak_method::FPA);
+  }
+  const uint64_t sn = sync.sn();
+  const uint64_t window = DEMOD_HISTORY * sn;
+  const uint32_t length = (uint32_t)std::llround(
+      (double)DEMOD_HISTORY * (1 << opt.sf) * rate / opt.bw);
+
+  // The start of the recording is preceded by zeros, as the history of the
+  // block, so a packet right at the start is found too
+  const uint64_t zeros = from == 0 ? (DEMOD_HISTORY - 1) * sn : 0;
+  std::vector<gr_complex> work;
+  if (resampler) {
+    work.reserve(zeros + resampler->max_output(n));
+    work.assign(zeros, gr_complex(0, 0));
+    resampler->process(x, n, work);
+    x = work.data();
+  } else if (zeros > 0) {
+    work.reserve(zeros + n);
+    work.assign(zeros, gr_complex(0, 0));
+    work.insert(work.end(), x, x + n);
+    x = work.data();
+  }
+  const uint64_t nx = (resampler || zeros > 0) ? work.size() : n;
+
+  uint64_t offset = 0;
+  while (offset + window - 1 + sync.max_step() <= nx) {
+    uint32_t num_consumed = sync.step(&x[offset + sn * (DEMOD_HISTORY - 1)]);
+    if (sync.detected()) {
+      double start =
+          (double)offset + sync.detection_offset() - (double)zeros;
+      if (resampler) {
+        start = start * resampler->decimation() / resampler->interpolation() -
+                resampler->delay();
+      }
+      uint64_t sample = from + (uint64_t)std::max<int64_t>(std::llround(start), 0);
+      if (sample >= begin && sample < end) {
+        hits.push_back({sample, length});
+      }
+      // Skip the detected packet, unless a colliding one may be in it
+      if (opt.peaks == 1) {
+        num_consumed = window;
+      }
+    }
+    offset += num_consumed;
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  options opt;
+  try {
+    if (!parse_args(argc, argv, opt)) {
+      usage(argv[0]);
+      return 1;
+    }
+  } catch (const std::exception &) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // The state machine logs every preamble, keep the output for detections
+  set_log_level(log_level::warning);
+
+  FILE *out = stdout;
+  if (!opt.output.empty() && (out = fopen(opt.output.c_str(), "w")) == NULL) {
+    perror(opt.output.c_str());
+    return 1;
+  }
+  if (!opt.json) {
+    fprintf(out, "file,sample,time_s,length\n");
+  }
+
+  worker_pool pool(opt.threads > 0 ? opt.threads : 0);
+  uint64_t total_samples = 0;
+  uint64_t total_detections = 0;
+  double total_signal = 0; // Seconds of signal replayed
+  auto t0 = std::chrono::steady_clock::now();
+
+  for (const std::string &path : opt.files) {
+    recording rec;
+    if (!open_recording(path, rec)) {
+      continue;
+    }
+    const uint32_t rate = opt.rate ? opt.rate : rec.rate ? rec.rate : 2 * opt.bw;
+    if (rate < opt.bw) {
+      fprintf(stderr, "%s: sample rate %u below the bandwidth\n", path.c_str(),
+              rate);
+      continue;
+    }
+
+    // Chunks overlap by a window and a few symbols before (the preamble of
+    // the first packet) and after (the SFD of the last one)
+    const uint64_t sn = (uint64_t)std::ceil((double)(1 << opt.sf) * rate / opt.bw);
+    const uint64_t lead = (DEMOD_HISTORY + 4) * sn;
+    const uint64_t tail = (DEMOD_HISTORY + 4) * sn;
+    const uint64_t chunk = opt.chunk_symbols * sn;
+    const size_t nchunks = (rec.samples + chunk - 1) / chunk;
+
+    // The name of the file as a field of the output
+    std::string field;
+    if (opt.json) {
+      sigmf_json_string(path, field);
+    } else {
+      field = csv_field(path);
+    }
+
+    std::vector<std::vector<detection>> hits(nchunks);
+    pool.parallel_for(nchunks, [&](size_t k) {
+      uint64_t begin = k * chunk;
+      uint64_t end = std::min(begin + chunk, rec.samples);
+      scan_chunk(opt, rec, rate, begin, end, lead, tail, hits[k]);
+    });
+
+    // Chunks are in order. A packet right on a chunk boundary can be seen
+    // by both sides with a slightly different window start: each detection
+    // of the previous chunk in the half window before the boundary drops
+    // the first one of this chunk close after it, in the half window after.
+    // Any other close detections are colliding packets (--peaks).
+    for (size_t k = 0; k < nchunks; k++) {
+      const uint64_t boundary = k * chunk;
+      std::vector<bool> duplicate(hits[k].size(), false);
+      if (k > 0) {
+        for (const detection &p : hits[k - 1]) {
+          if (p.sample + p.length / 2 < boundary) {
+            continue;
+          }
+          for (size_t i = 0; i < hits[k].size(); i++) {
+            const detection &d = hits[k][i];
+            if (!duplicate[i] && d.sample < boundary + d.length / 2 &&
+                d.sample < p.sample + d.length / 2) {
+              duplicate[i] = true;
+              break;
+            }
+          }
+        }
+      }
+      for (size_t i = 0; i < hits[k].size(); i++) {
+        if (duplicate[i]) {
+          continue;
+        }
+        const detection &d = hits[k][i];
+        total_detections++;
+        double t = (double)d.sample / rate;
+        if (opt.json) {
+          fprintf(out,
+                  "{\"file\": %s, \"sample\": %llu, \"time_s\": %.6f, "
+                  "\"length\": %u}\n",
+                  field.c_str(), (unsigned long long)d.sample, t, d.length);
+        } else {
+          fprintf(out, "%s,%llu,%.6f,%u\n", field.c_str(),
+                  (unsigned long long)d.sample, t, d.length);
+        }
+      }
+    }
+    total_samples += rec.samples;
+    total_signal += (double)rec.samples / rate;
+  }
+
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0)
+                       .count();
+  fprintf(stderr,
+          "files: %zu, samples: %llu, detections: %llu, threads: %u\n"
+          "elapsed: %.3f s, %.2f Msamples/s, %.1fx real time\n",
+          opt.files.size(), (unsigned long long)total_samples,
+          (unsigned long long)total_detections, pool.size(), elapsed,
+          total_samples / elapsed / 1e6,
+          elapsed > 0 ? total_signal / elapsed : 0.0);
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
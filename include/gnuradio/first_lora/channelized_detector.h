@@ -0,0 +1,73 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_H
+#define INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_H
+
+#include <gnuradio/block.h>
+#include <gnuradio/first_lora/api.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+/*!
+ * \brief LoRa detector over every channel of a wideband capture
+ * \ingroup first_lora
+ *
+ * \details Splits the input into nchannels channels spaced by
+ * samp_rate / nchannels with a polyphase filterbank, brings each searched
+ * channel down to 1x the bandwidth and runs the sync (method 1 or 3)
+ * preamble/SFD detection of lora_detector on it. The channels are spread
+ * over a pool of worker threads.
+ *
+ * Channel k is centred on k * samp_rate / nchannels, the upper half of the
+ * channels being the negative frequencies (k - nchannels).
+ *
+ * The input is passed through, delayed by the history of the block. The
+ * window of a detection (13 symbols, in input samples) is marked with a
+ * "burst_start" and a "burst_end" tag carrying its length and a "channel"
+ * tag on its first sample. A dictionary is published on the "detected"
+ * port with the keys "detected", "channel", "frequency" (channel centre in
+ * Hz, relative to the input), "offset" (first sample of the window in the
+ * input stream) and "length".
+ */
+class FIRST_LORA_API channelized_detector : virtual public gr::block {
+ public:
+  typedef std::shared_ptr<channelized_detector> sptr;
+
+  /*!
+   * \brief Return a shared_ptr to a new instance of
+   * first_lora::channelized_detector.
+   *
+   * To avoid accidental use of raw pointers, first_lora::channelized_detector's
+   * constructor is in a private implementation
+   * class. first_lora::channelized_detector::make is the public interface for
+   * creating new instances.
+   *
+   * \param sf Spreading factor
+   * \param bw Bandwidth
+   * \param samp_rate Input sampling rate, a multiple of nchannels. The
+   *        channel spacing must be at least the bandwidth.
+   * \param nchannels Number of channels of the filterbank
+   * \param channels Channels searched (empty: all of them)
+   * \param method Detection method (1: sync, 3: sync with the FPA peak
+   *               search), as in lora_detector
+   * \param nthreads Worker threads (0: one per core)
+   */
+  static sptr make(uint8_t sf = 7, uint32_t bw = 125000,
+                   uint32_t samp_rate = 1600000, int nchannels = 8,
+                   const std::vector<int> &channels = std::vector<int>(),
+                   int method = 1, int nthreads = 0);
+};
+
+}  // namespace first_lora
+}  // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_H */
@@ -0,0 +1,44 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_LOG_H
+#define INCLUDED_FIRST_LORA_LOG_H
+
+#include <gnuradio/first_lora/api.h>
+
+namespace gr {
+namespace first_lora {
+
+/*!
+ * \brief Verbosity of the first_lora blocks
+ * \ingroup first_lora
+ */
+enum class log_level { debug = 0, info, warning, error, off };
+
+/*!
+ * \brief Set the level of the messages printed by every first_lora block
+ * \ingroup first_lora
+ *
+ * \details The blocks only queue their messages, a background thread formats
+ * and prints them, so logging never blocks the scheduler. Messages below the
+ * level are dropped before being queued (off disables logging entirely).
+ * Can be changed at any time, including while the flowgraph runs.
+ *
+ * \param level Lowest level printed
+ */
+FIRST_LORA_API void set_log_level(log_level level);
+
+/*!
+ * \brief Current level of the first_lora messages
+ * \ingroup first_lora
+ */
+FIRST_LORA_API log_level get_log_level();
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_LOG_H */
@@ -11,6 +11,11 @@
 #include <gnuradio/block.h>
 #include <gnuradio/first_lora/api.h>
 
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
 namespace gr {
 namespace first_lora {
 
@@ -33,9 +38,102 @@ class FIRST_LORA_API lora_detector : virtual public gr::block {
    * constructor is in a private implementation
    * class. first_lora::lora_detector::make is the public interface for
    * creating new instances.
+   *
+   * \param threshold Detection threshold (methods 0 and 4)
+   * \param sf Spreading factor
+   * \param bw Bandwidth
+   * \param method Detection method (0: threshold, 1: sync, 2: debug,
+   *               3: sync with the fine phase alignment (FPA) peak search,
+   *               more sensitive than the coarse one (CPA) of method 1,
+   *               4: sliding-window energy, every window of one symbol
+   *               whose RMS amplitude reaches the threshold)
+   * \param batch Process every complete symbol of the input buffer in one
+   *              call instead of a single symbol per call (off by default,
+   *              as before it was added)
+   * \param padding Zero-padding factor of the dechirp FFT. Below 10 the
+   *                peak is interpolated between bins to keep the same
+   *                precision for a fraction of the FFT cost.
+   * \param output_mode What a detection produces:
+   *        0: the 13 symbols window is copied to the output,
+   *        1: the input is passed through (delayed by the 13 symbols
+   *           history) and the window is marked with "burst_start" and
+   *           "burst_end" stream tags, both carrying the window length,
+   *        2: nothing is output.
+   *        In modes 1 and 2 the "detected" message is a dictionary with
+   *        the keys "detected", "offset" (first sample of the window in the
+   *        input stream) and "length".
+   * \param samp_rate Input sampling rate. 0 means 2x the bandwidth, fed
+   *        as is to the dechirp. Any other rate goes through a polyphase
+   *        resampler down to 1x the bandwidth, halving the FFT size, before
+   *        the sync methods (1 and 3); methods 0 and 4 work on the input
+   *        samples and the debug method is not available. The output window
+   *        and the offsets are always in input samples.
+   * \param max_peaks Peaks of each symbol followed as candidate preambles
+   *        by the sync methods (1 to 8). Above 1, the preamble of a weaker
+   *        packet colliding with a stronger one of the same SF is found
+   *        too (down to a quarter of its amplitude), and the input is no
+   *        longer skipped after a detection, so overlapping windows can be
+   *        output.
+   * \param hop Windows per symbol of the preamble search of the sync
+   *        methods (1, 2, 4 or 8, max_peaks 1 only). Above 1 the preamble
+   *        is found and aligned on up to a symbol earlier, with an FFT
+   *        without padding for the extra windows.
+   * \param nthreads Threads dechirping the windows of the preamble search
+   *        ahead of the state machine, caller included, so a backlog of
+   *        input is worked through on several cores (0: one per core).
+   *        Only for the sync methods in batch mode with max_peaks 1; the
+   *        SFD and the output still run on the scheduler thread.
+   * \param low_latency Let the block run on any amount of input instead of
+   *        waiting for room for a whole window (output multiple 1 instead
+   *        of 13 symbols). Only output mode 2, where the window is just
+   *        located, also brings the history down to one symbol. Output
+   *        mode 1 still keeps a whole window (13 symbols, and the lag of
+   *        a detection with max_peaks above 1) in its history and delays
+   *        its tags as much, since they mark those samples. Not for mode 0
+   *        nor the debug method. The "latency_samples" counters of stats()
+   *        show the effect.
+   * \param sc16 Complex int16 input and output items (sc16, as SDRs
+   *        deliver them, 32768 for an amplitude of 1) instead of
+   *        gr_complex, with no conversion block in front: each symbol is
+   *        converted as it is loaded into the FFT. Sync methods (1 and 3)
+   *        only.
    */
   static sptr make(float threshold = 0.1, uint8_t sf = 7, uint32_t bw = 125000,
-                   int method = 0);
+                   int method = 0, bool batch = false, int padding = 10,
+                   int output_mode = 0, uint32_t samp_rate = 0,
+                   int max_peaks = 1, int hop = 1, int nthreads = 1,
+                   bool low_latency = false, bool sc16 = false);
+
+  /*!
+   * \brief Counters of this block since its creation or reset_stats()
+   *
+   * Keys: "calls" (general_work calls), "samples" (input samples consumed),
+   * "detections", and for the sync methods "symbols" (symbols dechirped),
+   * "ffts", "preambles", "sfd_found", "sfd_failed" (SFD recovery failed)
+   * and "time_ns_reset", "time_ns_preamble", "time_ns_sfd",
+   * "time_ns_output" (time spent in each state of the state machine).
+   * "latency_samples" sums, over the detections, the input that was
+   * already buffered past the last sample a detection needed (divide by
+   * "detections" for the mean), "latency_samples_max" is the largest.
+   * The same dictionary, plus "peak_histogram", is published on the "stats"
+   * message port.
+   */
+  virtual std::map<std::string, uint64_t> stats() = 0;
+
+  /*!
+   * \brief Number of upchirp peaks seen in each symbol bin (2^sf bins)
+   */
+  virtual std::vector<uint64_t> peak_histogram() = 0;
+
+  /*!
+   * \brief Set every counter and the histogram back to zero
+   */
+  virtual void reset_stats() = 0;
+
+  /*!
+   * \brief Period of the "stats" messages in seconds (0 disables them)
+   */
+  virtual void set_stats_interval(double seconds) = 0;
 };
 
 }  // namespace first_lora
@@ -0,0 +1,54 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_H
+#define INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_H
+
+#include <gnuradio/block.h>
+#include <gnuradio/first_lora/api.h>
+
+namespace gr {
+namespace first_lora {
+
+/*!
+ * \brief LoRa detector searching several spreading factors at once
+ * \ingroup first_lora
+ *
+ * \details Runs the sync (method 1) preamble/SFD detection of lora_detector
+ * for every SF in [sf_min, sf_max] over a single input buffer and history.
+ * The per-SF dechirp and preamble tracking is spread over a pool of worker
+ * threads. On a detection, the window of the detected packet (13 symbols of
+ * its SF, so its length depends on the SF) is written to the output and a
+ * dictionary is published on the "detected" port with the keys "detected"
+ * (true), "sf" and "length" (samples written).
+ */
+class FIRST_LORA_API multi_sf_detector : virtual public gr::block {
+ public:
+  typedef std::shared_ptr<multi_sf_detector> sptr;
+
+  /*!
+   * \brief Return a shared_ptr to a new instance of
+   * first_lora::multi_sf_detector.
+   *
+   * To avoid accidental use of raw pointers, first_lora::multi_sf_detector's
+   * constructor is in a private implementation
+   * class. first_lora::multi_sf_detector::make is the public interface for
+   * creating new instances.
+   *
+   * \param sf_min Smallest spreading factor searched
+   * \param sf_max Largest spreading factor searched
+   * \param bw Bandwidth
+   * \param nthreads Worker threads (0: one per core)
+   */
+  static sptr make(uint8_t sf_min = 7, uint8_t sf_max = 12,
+                   uint32_t bw = 125000, int nthreads = 0);
+};
+
+}  // namespace first_lora
+}  // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_H */
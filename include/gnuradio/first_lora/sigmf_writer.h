@@ -0,0 +1,94 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_SIGMF_WRITER_H
+#define INCLUDED_FIRST_LORA_SIGMF_WRITER_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/sync_block.h>
+
+#include <string>
+
+namespace gr {
+namespace first_lora {
+
+/*!
+ * \brief Records its inputs as SigMF recordings
+ * \ingroup first_lora
+ *
+ * \details Native replacement of the Python file_writer. Input i is written
+ * to <filename>_input<i>.sigmf-data (a timestamp is appended to filename if
+ * one of the files exists) by a background thread from large page aligned
+ * double buffers, so the flowgraph only pays for a memory copy.
+ *
+ * Every message on the "detected" port of an input (true, or a dictionary
+ * with "detected" true, as the detectors publish) annotates the next
+ * sample written on that input. The ports are named "detected" with a
+ * single input and "detected0", "detected1", ... otherwise.
+ *
+ * The <filename>_input<i>.sigmf-meta files have the same global fields and
+ * annotations as with file_writer. Annotations are not kept in memory: a
+ * second background thread appends each one to
+ * <filename>_input<i>.sigmf-meta.journal as it comes, and brings the
+ * .sigmf-meta files up to date every few seconds and when the flowgraph
+ * stops, after which the journals are removed. The block never waits for
+ * that thread: an annotation that comes while 1024 are still queued is
+ * dropped, and the number dropped is logged as a warning.
+ *
+ * With is_loopback, the block listens on ip_address:port for the device
+ * id of the transmitter being recorded (apps/lora_control.py is a client).
+ * Each command is a line, answered with "ACK":
+ *   - "<id>": record the next samples to <filename>_device_<id>_input<i>,
+ *     starting with the first sample of the next call of the block;
+ *   - "<id> <sample>": the same, starting exactly at that sample of the
+ *     input (counted from the start of the flowgraph);
+ *   - "position": reply with the number of samples consumed so far;
+ *   - "close": finish the recordings and end the flowgraph.
+ * The previous files are finished in the background, the flowgraph never
+ * waits for a client.
+ */
+class FIRST_LORA_API sigmf_writer : virtual public gr::sync_block {
+ public:
+  typedef std::shared_ptr<sigmf_writer> sptr;
+
+  /*!
+   * \brief Return a shared_ptr to a new instance of first_lora::sigmf_writer.
+   *
+   * To avoid accidental use of raw pointers, first_lora::sigmf_writer's
+   * constructor is in a private implementation
+   * class. first_lora::sigmf_writer::make is the public interface for
+   * creating new instances.
+   *
+   * \param filename Base name of the recordings
+   * \param author core:author
+   * \param description core:description
+   * \param item_size Size of an input item in bytes (8: cf32, 4: rf32 or
+   *        ci16, 2: ri16)
+   * \param item_type Complex items
+   * \param sample_rate core:sample_rate
+   * \param frequency Centre frequency of the annotations
+   * \param hw core:hw
+   * \param version core:version
+   * \param num_inputs Number of inputs
+   * \param is_loopback Listen for device ids and switch files on each one
+   * \param ip_address Address to listen on
+   * \param port TCP port to listen on
+   */
+  static sptr make(const std::string &filename, const std::string &author,
+                   const std::string &description, int item_size = 8,
+                   bool item_type = true, double sample_rate = 250000,
+                   double frequency = 868e6, const std::string &hw = "",
+                   const std::string &version = "0.0.1", int num_inputs = 1,
+                   bool is_loopback = false,
+                   const std::string &ip_address = "localhost",
+                   int port = 12345);
+};
+
+}  // namespace first_lora
+}  // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_SIGMF_WRITER_H */
@@ -0,0 +1,176 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "async_logger.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+namespace gr {
+namespace first_lora {
+
+static const char *level_name(log_level level) {
+  switch (level) {
+  case log_level::debug:
+    return "DEBUG";
+  case log_level::info:
+    return "INFO";
+  case log_level::warning:
+    return "WARN";
+  case log_level::error:
+    return "ERROR";
+  default:
+    return "";
+  }
+}
+
+async_logger &async_logger::instance() {
+  static async_logger logger;
+  return logger;
+}
+
+async_logger::async_logger()
+    : d_level((int)log_level::info), d_head(0), d_tail(0), d_dropped(0),
+      d_running(true) {
+  d_slots = new slot[LOG_QUEUE_SIZE];
+  for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+    d_slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  d_line.reserve(LOG_LINE_SIZE);
+  d_thread = std::thread(&async_logger::drain_loop, this);
+}
+
+async_logger::~async_logger() {
+  d_running = false;
+  d_thread.join();
+  drain();
+  delete[] d_slots;
+}
+
+bool async_logger::push(const log_record &rec) {
+  // Bounded MPMC queue with a sequence number per slot (D. Vyukov): a
+  // producer owns slot pos once it wins the CAS on d_head, the sequence then
+  // tells the consumer the record is complete.
+  size_t pos = d_head.load(std::memory_order_relaxed);
+  slot *s;
+  for (;;) {
+    s = &d_slots[pos % LOG_QUEUE_SIZE];
+    size_t seq = s->seq.load(std::memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      if (d_head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      // Full, the drain thread is behind: drop rather than wait
+      d_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = d_head.load(std::memory_order_relaxed);
+    }
+  }
+
+  s->rec = rec;
+  s->rec.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  s->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool async_logger::pop(log_record &rec) {
+  size_t pos = d_tail.load(std::memory_order_relaxed);
+  slot *s = &d_slots[pos % LOG_QUEUE_SIZE];
+  if (s->seq.load(std::memory_order_acquire) != pos + 1) {
+    return false; // Empty, or the producer is still writing
+  }
+  rec = s->rec;
+  s->seq.store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+  d_tail.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void async_logger::format(const log_record &rec, std::string &line) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%" PRIu64 ".%06" PRIu64 " %s %s: ",
+           rec.time_us / 1000000, rec.time_us % 1000000,
+           level_name(rec.level), rec.src);
+  line = buf;
+
+  uint32_t arg = 0;
+  for (const char *p = rec.fmt; *p; p++) {
+    if (p[0] == '{' && p[1] == '}' && arg < rec.nargs) {
+      const log_arg &a = rec.args[arg++];
+      switch (a.type) {
+      case log_arg::INT:
+        snprintf(buf, sizeof(buf), "%" PRId64, a.i);
+        break;
+      case log_arg::UINT:
+        snprintf(buf, sizeof(buf), "%" PRIu64, a.u);
+        break;
+      case log_arg::FLOAT:
+        snprintf(buf, sizeof(buf), "%g", a.f);
+        break;
+      case log_arg::STR:
+        snprintf(buf, sizeof(buf), "%s", a.s);
+        break;
+      case log_arg::COMPLEX:
+        snprintf(buf, sizeof(buf), "(%g,%g)", a.c[0], a.c[1]);
+        break;
+      }
+      line += buf;
+      p++;
+    } else {
+      line += *p;
+    }
+  }
+  line += '\n';
+}
+
+size_t async_logger::drain() {
+  log_record rec;
+  size_t n = 0;
+  while (pop(rec)) {
+    format(rec, d_line);
+    fwrite(d_line.data(), 1, d_line.size(), stdout);
+    n++;
+  }
+  uint64_t dropped = d_dropped.exchange(0);
+  if (dropped) {
+    fprintf(stdout, "first_lora: %" PRIu64 " log messages dropped\n", dropped);
+  }
+  if (n || dropped) {
+    fflush(stdout);
+  }
+  return n;
+}
+
+void async_logger::drain_loop() {
+  while (d_running.load()) {
+    if (drain() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  }
+}
+
+void async_logger::flush() {
+  size_t target = d_head.load();
+  while (d_tail.load(std::memory_order_acquire) < target && d_running.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void set_log_level(log_level level) {
+  async_logger::instance().set_level(level);
+}
+
+log_level get_log_level() { return async_logger::instance().level(); }
+
+} /* namespace first_lora */
+} /* namespace gr */
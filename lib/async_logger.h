@@ -0,0 +1,192 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_ASYNC_LOGGER_H
+#define INCLUDED_FIRST_LORA_ASYNC_LOGGER_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/first_lora/log.h>
+#include <gnuradio/gr_complex.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#define LOG_QUEUE_SIZE 4096 // Records queued before new ones are dropped
+#define LOG_MAX_ARGS 4      // Arguments of a record
+#define LOG_LINE_SIZE 256   // Line capacity kept by the drain thread
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief One argument of a log record, formatted by the drain thread
+ */
+struct log_arg {
+  enum { INT, UINT, FLOAT, STR, COMPLEX } type;
+  union {
+    int64_t i;
+    uint64_t u;
+    double f;
+    const char *s; // Must outlive the record (string literal)
+    float c[2];
+  };
+};
+
+/**
+ * @brief A log message, its format is only expanded by the drain thread
+ */
+struct log_record {
+  log_level level;
+  const char *src; // Block name (string literal)
+  const char *fmt; // Format, each {} is replaced by an argument (literal)
+  uint64_t time_us; // Wall clock time in microseconds
+  uint32_t nargs;
+  log_arg args[LOG_MAX_ARGS];
+};
+
+/**
+ * @brief Process wide non-blocking logger
+ *
+ * The blocks push fixed size records into a bounded lock-free queue
+ * (multiple producers, one consumer). A background thread pops, formats and
+ * prints them. Nothing on the producer side allocates, locks or does I/O:
+ * when the queue is full the record is dropped and counted.
+ */
+class FIRST_LORA_API async_logger {
+private:
+  struct slot {
+    std::atomic<size_t> seq; // Ticket of the producer/consumer owning the slot
+    log_record rec;
+  };
+
+  std::atomic<int> d_level;          // Lowest level queued
+  slot *d_slots;                     // LOG_QUEUE_SIZE slots
+  alignas(64) std::atomic<size_t> d_head; // Next slot to write
+  alignas(64) std::atomic<size_t> d_tail; // Next slot to read (drain thread)
+  std::atomic<uint64_t> d_dropped;   // Records lost to a full queue
+  std::atomic<bool> d_running;       // Drain thread keeps going
+  std::string d_line;                // Line being printed, reused so that
+                                     // printing does not allocate
+  std::thread d_thread;              // Drain thread
+
+  async_logger();
+
+  bool pop(log_record &rec);
+  void drain_loop();
+  /** @brief Print every queued record, returns how many */
+  size_t drain();
+  static void format(const log_record &rec, std::string &line);
+
+  static log_arg to_arg(const char *s) {
+    log_arg a;
+    a.type = log_arg::STR;
+    a.s = s;
+    return a;
+  }
+  static log_arg to_arg(const gr_complex &c) {
+    log_arg a;
+    a.type = log_arg::COMPLEX;
+    a.c[0] = c.real();
+    a.c[1] = c.imag();
+    return a;
+  }
+  template <typename T> static log_arg to_arg(T v) {
+    static_assert(std::is_arithmetic<T>::value, "unsupported log argument");
+    log_arg a;
+    if (std::is_floating_point<T>::value) {
+      a.type = log_arg::FLOAT;
+      a.f = (double)v;
+    } else if (std::is_signed<T>::value) {
+      a.type = log_arg::INT;
+      a.i = (int64_t)v;
+    } else {
+      a.type = log_arg::UINT;
+      a.u = (uint64_t)v;
+    }
+    return a;
+  }
+
+public:
+  ~async_logger();
+
+  async_logger(const async_logger &) = delete;
+  async_logger &operator=(const async_logger &) = delete;
+
+  /** @brief The logger shared by every block */
+  static async_logger &instance();
+
+  void set_level(log_level level) { d_level.store((int)level); }
+  log_level level() const { return (log_level)d_level.load(); }
+
+  /** @brief Whether a message of this level would be queued */
+  bool enabled(log_level level) const {
+    return (int)level >= d_level.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Queue a record, never blocks
+   * @return false if the queue was full and the record dropped
+   */
+  bool push(const log_record &rec);
+
+  /**
+   * @brief Queue a message
+   * @param level Level of the message
+   * @param src Name of the block (string literal)
+   * @param fmt Format, each {} is replaced by the next argument (literal)
+   * @param args Up to LOG_MAX_ARGS numbers, complex or string literals
+   */
+  template <typename... Args>
+  void log(log_level level, const char *src, const char *fmt,
+           const Args &...args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    if (!enabled(level)) {
+      return;
+    }
+    log_record rec;
+    rec.level = level;
+    rec.src = src;
+    rec.fmt = fmt;
+    rec.time_us = 0; // Stamped by push()
+    rec.nargs = 0;
+    ((rec.args[rec.nargs++] = to_arg(args)), ...);
+    push(rec);
+  }
+
+  /** @brief Records dropped since the start */
+  uint64_t dropped() const { return d_dropped.load(); }
+
+  /** @brief Print everything queued so far (tests, shutdown) */
+  void flush();
+};
+
+template <typename... Args>
+inline void log_debug(const char *src, const char *fmt, const Args &...args) {
+  async_logger::instance().log(log_level::debug, src, fmt, args...);
+}
+template <typename... Args>
+inline void log_info(const char *src, const char *fmt, const Args &...args) {
+  async_logger::instance().log(log_level::info, src, fmt, args...);
+}
+template <typename... Args>
+inline void log_warning(const char *src, const char *fmt,
+                        const Args &...args) {
+  async_logger::instance().log(log_level::warning, src, fmt, args...);
+}
+template <typename... Args>
+inline void log_error(const char *src, const char *fmt, const Args &...args) {
+  async_logger::instance().log(log_level::error, src, fmt, args...);
+}
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_ASYNC_LOGGER_H */
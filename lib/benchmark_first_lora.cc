@@ -0,0 +1,357 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * Micro-benchmark of the detector DSP kernels.
+ *
+ * Every kernel is timed for each SF and zero-padding factor and reported as
+ * one CSV line (or JSON object) so two builds can be diffed:
+ *
+ *   benchmark_first_lora --sf 7-12 --padding 1,2,5,10 --format csv > a.csv
+ *
+ * The _sc16 kernels take complex int16 symbols, convert_dechirp_sc16 with a
+ * conversion into a separate buffer first as a conversion block would.
+ */
+
+#include "chirp_cache.h"
+#include "dechirp_engine.h"
+#include "detector_kernels.h"
+#include "polyphase_resampler.h"
+
+#include <gnuradio/gr_complex.h>
+#include <volk/volk.h>
+#include <volk/volk_malloc.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace gr::first_lora;
+
+namespace {
+
+struct options {
+  int sf_min = 7;
+  int sf_max = 12;
+  std::vector<int> paddings = {1, 2, 5, 10};
+  double min_time = 0.2; // Seconds spent on each kernel
+  bool json = false;
+};
+
+struct result {
+  std::string kernel;
+  int sf;
+  int padding;
+  uint32_t fft_size;
+  uint64_t iterations;
+  double ns_per_symbol;
+  double samples_per_s;
+};
+
+volatile float g_sink; // Keeps the kernels from being optimised away
+
+/**
+ * @brief One rotation of the previous FPA peak search, which ran it for
+ * each of the 4 phase offsets: rotate the head of the spectrum, add the
+ * tail, magnitude and argmax
+ * @param fft_result FFT result (fft_size)
+ * @param buffer Magnitude (bin_size)
+ * @param buffer_c Rotated sum (bin_size)
+ * @param max_val_p Magnitude of the peak
+ * @param phase_offset Rotation of the head
+ * @return Index of the peak
+ */
+uint32_t fft_add(const lv_32fc_t *fft_result, uint32_t fft_size,
+                 uint32_t bin_size, float *buffer, gr_complex *buffer_c,
+                 float *max_val_p, float phase_offset) {
+  lv_32fc_t s =
+      lv_cmake((float)std::cos(phase_offset), (float)std::sin(phase_offset));
+  volk_32fc_s32fc_multiply_32fc(buffer_c, fft_result, s, bin_size);
+  volk_32fc_x2_add_32fc(buffer_c, buffer_c, &fft_result[fft_size - bin_size],
+                        bin_size);
+  volk_32fc_magnitude_32f(buffer, buffer_c, bin_size);
+  return dechirp_engine::argmax_32f(buffer, max_val_p, bin_size);
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--sf MIN-MAX] [--padding P1,P2,...] [--time SECONDS] "
+          "[--format csv|json]\n",
+          prog);
+}
+
+bool parse_args(int argc, char **argv, options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string val = argv[++i];
+    if (arg == "--sf") {
+      size_t dash = val.find('-');
+      opt.sf_min = std::stoi(val.substr(0, dash));
+      opt.sf_max =
+          dash == std::string::npos ? opt.sf_min : std::stoi(val.substr(dash + 1));
+    } else if (arg == "--padding") {
+      opt.paddings.clear();
+      size_t start = 0;
+      while (start < val.size()) {
+        size_t comma = val.find(',', start);
+        opt.paddings.push_back(std::stoi(val.substr(start, comma - start)));
+        start = comma == std::string::npos ? val.size() : comma + 1;
+      }
+    } else if (arg == "--time") {
+      opt.min_time = std::stod(val);
+    } else if (arg == "--format") {
+      opt.json = val == "json";
+    } else {
+      return false;
+    }
+  }
+  return opt.sf_min >= 6 && opt.sf_max <= 12 && opt.sf_min <= opt.sf_max &&
+         !opt.paddings.empty();
+}
+
+/**
+ * @brief Run f until min_time has elapsed and return the time per call
+ */
+double time_kernel(const std::function<void(uint64_t)> &f, double min_time,
+                   uint64_t *iterations) {
+  using clock = std::chrono::steady_clock;
+  // Warm up (page faults, plan caches)
+  for (uint64_t i = 0; i < 8; i++) {
+    f(i);
+  }
+  uint64_t n = 0;
+  uint64_t batch = 16;
+  auto start = clock::now();
+  double elapsed = 0;
+  while (elapsed < min_time) {
+    for (uint64_t i = 0; i < batch; i++) {
+      f(n + i);
+    }
+    n += batch;
+    batch *= 2;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  }
+  *iterations = n;
+  return elapsed * 1e9 / n;
+}
+
+void print_result(const result &r, bool json, bool first) {
+  if (json) {
+    printf("%s\n  {\"kernel\": \"%s\", \"sf\": %d, \"padding\": %d, "
+           "\"fft_size\": %u, \"iterations\": %llu, \"ns_per_symbol\": %.1f, "
+           "\"samples_per_s\": %.0f}",
+           first ? "" : ",", r.kernel.c_str(), r.sf, r.padding, r.fft_size,
+           (unsigned long long)r.iterations, r.ns_per_symbol, r.samples_per_s);
+  } else {
+    printf("%s,%d,%d,%u,%llu,%.1f,%.0f\n", r.kernel.c_str(), r.sf, r.padding,
+           r.fft_size, (unsigned long long)r.iterations, r.ns_per_symbol,
+           r.samples_per_s);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  options opt;
+  if (!parse_args(argc, argv, opt)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const uint32_t bw = 125000;
+  const uint32_t fs = 2 * bw;
+  const int nsymbols = 16; // Distinct random symbols cycled through
+  std::mt19937 rng(1234);
+  std::normal_distribution<float> noise(0, 0.1);
+
+  if (opt.json) {
+    printf("[");
+  } else {
+    printf("kernel,sf,padding,fft_size,iterations,ns_per_symbol,"
+           "samples_per_s\n");
+  }
+  bool first = true;
+
+  for (int sf = opt.sf_min; sf <= opt.sf_max; sf++) {
+    const uint32_t sps = 1 << sf;
+    const uint32_t sn = 2 * sps;
+    auto chirps = get_chirp_table(sf, bw, fs);
+    const lv_32fc_t *up = chirps->up;
+
+    // Random LoRa symbols (shifted upchirps) plus some noise
+    std::vector<gr_complex> symbols(nsymbols * sn);
+    for (int k = 0; k < nsymbols; k++) {
+      uint32_t shift = 2 * (rng() % sps);
+      for (uint32_t i = 0; i < sn; i++) {
+        symbols[k * sn + i] =
+            up[(i + shift) % sn] + gr_complex(noise(rng), noise(rng));
+      }
+    }
+    auto symbol = [&](uint64_t i) { return &symbols[(i % nsymbols) * sn]; };
+    // The same symbols as an SDR delivers them
+    std::vector<lv_16sc_t> symbols16(nsymbols * sn);
+    for (size_t i = 0; i < symbols16.size(); i++) {
+      symbols16[i] = lv_16sc_t(
+          (int16_t)std::lround(0.25f * SC16_SCALE * symbols[i].real()),
+          (int16_t)std::lround(0.25f * SC16_SCALE * symbols[i].imag()));
+    }
+    auto symbol16 = [&](uint64_t i) {
+      return &symbols16[(i % nsymbols) * sn];
+    };
+    std::vector<gr_complex> converted(sn);
+
+    for (int padding : opt.paddings) {
+      const uint32_t fft_size = padding * sn;
+      const uint32_t bin_size = padding * sps;
+      // Peaks reported on the detector resolution, as in sync_detector, so
+      // dechirp includes the interpolation below 10x padding
+      dechirp_engine engine(sn, fft_size, bin_size, chirps, 10 * sps);
+
+      float *b1 = (float *)volk_malloc(fft_size * sizeof(float),
+                                       volk_get_alignment());
+      float *b2 = (float *)volk_malloc(bin_size * sizeof(float),
+                                       volk_get_alignment());
+      gr_complex *bc = (gr_complex *)volk_malloc(bin_size * sizeof(gr_complex),
+                                                 volk_get_alignment());
+      float *energy = (float *)volk_malloc(2 * 4096 * sizeof(float),
+                                           volk_get_alignment());
+      polyphase_resampler resampler(fs, bw);
+      std::vector<gr_complex> resampled;
+      resampled.reserve(resampler.max_output(sn));
+
+      std::vector<std::pair<std::string, std::function<void(uint64_t)>>>
+          kernels = {
+              {"dechirp",
+               [&](uint64_t i) {
+                 g_sink = engine.dechirp(symbol(i), true).first;
+               }},
+              {"dechirp_up_down",
+               [&](uint64_t i) {
+                 g_sink = engine.dechirp(symbol(i), true).first +
+                          engine.dechirp(symbol(i), false).first;
+               }},
+              {"dechirp_dual",
+               [&](uint64_t i) {
+                 auto p = engine.dechirp_dual(symbol(i));
+                 g_sink = p.up_val + p.down_val;
+               }},
+              {"dechirp_sc16",
+               [&](uint64_t i) {
+                 g_sink = engine.dechirp(symbol16(i), true).first;
+               }},
+              {"convert_dechirp_sc16",
+               [&](uint64_t i) {
+                 // A conversion block in front, then the float dechirp
+                 volk_16i_s32f_convert_32f((float *)converted.data(),
+                                           (const int16_t *)symbol16(i),
+                                           SC16_SCALE, 2 * sn);
+                 g_sink = engine.dechirp(converted.data(), true).first;
+               }},
+              {"dechirp_dual_sc16",
+               [&](uint64_t i) {
+                 auto p = engine.dechirp_dual(symbol16(i));
+                 g_sink = p.up_val + p.down_val;
+               }},
+              {"get_fft_peak_abs",
+               [&](uint64_t) {
+                 float max;
+                 engine.get_fft_peak_abs(engine.fft_result(), b2, &max);
+                 g_sink = max;
+               }},
+              {"cpa_three_pass",
+               [&](uint64_t) {
+                 // Previous CPA search: magnitude, fold and argmax passes
+                 float max;
+                 volk_32fc_magnitude_32f(b1, engine.fft_result(), fft_size);
+                 volk_32f_x2_add_32f(b2, b1, &b1[fft_size - bin_size],
+                                     bin_size);
+                 dechirp_engine::argmax_32f(b2, &max, bin_size);
+                 g_sink = max;
+               }},
+              {"get_fft_peak_phase",
+               [&](uint64_t) {
+                 float max;
+                 engine.get_fft_peak_phase(engine.fft_result(), &max);
+                 g_sink = max;
+               }},
+              {"fpa_peak_32fc",
+               [&](uint64_t) {
+                 float max;
+                 fpa_peak_32fc(engine.fft_result(),
+                               &engine.fft_result()[fft_size - bin_size],
+                               bin_size, &max);
+                 g_sink = max;
+               }},
+              {"fft_add",
+               [&](uint64_t) {
+                 float max;
+                 fft_add(engine.fft_result(), fft_size, bin_size, b2, bc,
+                         &max, 0);
+                 g_sink = max;
+               }},
+              {"argmax_32f",
+               [&](uint64_t) {
+                 float max;
+                 dechirp_engine::argmax_32f(b2, &max, bin_size);
+                 g_sink = max;
+               }},
+              {"energy_crossing",
+               [&](uint64_t i) {
+                 // The sn + 1 windows ending in the second of two symbols
+                 g_sink = energy_crossing_32fc(
+                     &symbols[(i % (nsymbols - 1)) * sn], 2 * sn, sn, sn - 1,
+                     1e30f, energy, 2 * 4096);
+               }},
+              {"resample_2x_to_1x",
+               [&](uint64_t i) {
+                 // Front end of lora_detector with samp_rate = 2 * bw
+                 resampled.clear();
+                 resampler.process(symbol(i), sn, resampled);
+                 g_sink = resampled[0].real();
+               }},
+              {"compare_peak",
+               [&](uint64_t i) { g_sink = max_amplitude_32fc(symbol(i), sn); }},
+          };
+
+      // Leave a real spectrum in the engine for the peak kernels
+      engine.dechirp(symbol(0), true);
+      memset(b2, 0, bin_size * sizeof(float));
+
+      for (auto &k : kernels) {
+        result r;
+        r.kernel = k.first;
+        r.sf = sf;
+        r.padding = padding;
+        r.fft_size = fft_size;
+        r.ns_per_symbol = time_kernel(k.second, opt.min_time, &r.iterations);
+        r.samples_per_s = sn / (r.ns_per_symbol * 1e-9);
+        print_result(r, opt.json, first);
+        first = false;
+        fflush(stdout);
+      }
+
+      volk_free(b1);
+      volk_free(b2);
+      volk_free(bc);
+      volk_free(energy);
+    }
+  }
+
+  if (opt.json) {
+    printf("\n]\n");
+  }
+  return 0;
+}
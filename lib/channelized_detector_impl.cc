@@ -0,0 +1,219 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "channelized_detector_impl.h"
+#include "async_logger.h"
+
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace gr {
+namespace first_lora {
+
+using input_type = gr_complex;
+using output_type = gr_complex;
+channelized_detector::sptr
+channelized_detector::make(uint8_t sf, uint32_t bw, uint32_t samp_rate,
+                           int nchannels, const std::vector<int> &channels,
+                           int method, int nthreads) {
+  return gnuradio::make_block_sptr<channelized_detector_impl>(
+      sf, bw, samp_rate, nchannels, channels, method, nthreads);
+}
+
+static unsigned pool_size(int nthreads, unsigned nlanes) {
+  unsigned n = nthreads > 0 ? nthreads : std::thread::hardware_concurrency();
+  return std::max(1u, std::min(n, nlanes));
+}
+
+/*
+ * The private constructor
+ */
+channelized_detector_impl::channelized_detector_impl(
+    uint8_t sf, uint32_t bw, uint32_t samp_rate, int nchannels,
+    const std::vector<int> &channels, int method, int nthreads)
+    : gr::block("channelized_detector",
+                gr::io_signature::make(1 /* min inputs */, 1 /* max inputs */,
+                                       sizeof(input_type)),
+                gr::io_signature::make(1 /* min outputs */, 1 /*max outputs */,
+                                       sizeof(output_type))),
+      d_bw(bw), d_fs(samp_rate), d_nchannels(std::max(nchannels, 0)),
+      d_pfb(d_nchannels),
+      d_lanes(channels.empty() ? d_nchannels : channels.size()),
+      d_pool(pool_size(nthreads, d_lanes.size())) {
+  if (sf < 6 || sf > 12) {
+    throw std::invalid_argument("channelized_detector: SF must be within [6, 12]");
+  }
+  if (method != 1 && method != 3) {
+    throw std::invalid_argument("channelized_detector: method must be 1 or 3");
+  }
+  if (d_fs % d_nchannels != 0 || d_fs / d_nchannels < d_bw) {
+    throw std::invalid_argument("channelized_detector: samp_rate must be a "
+                                "multiple of nchannels, with channels at least "
+                                "as wide as the bandwidth");
+  }
+
+  const uint32_t channel_rate = d_fs / d_nchannels;
+  for (size_t i = 0; i < d_lanes.size(); i++) {
+    channel_lane &lane = d_lanes[i];
+    lane.channel = channels.empty() ? (int)i : channels[i];
+    if (lane.channel < 0 || lane.channel >= (int)d_nchannels) {
+      throw std::invalid_argument("channelized_detector: channel out of range");
+    }
+    lane.resampler = std::make_unique<polyphase_resampler>(channel_rate, d_bw);
+    lane.sync = std::make_unique<sync_detector>(sf, d_bw, d_bw);
+    if (method == 3) {
+      lane.sync->engine().set_peak_method(peak_method::FPA);
+    }
+    // Like the history of the block, zeros in front of the first symbol
+    const uint32_t sn = lane.sync->sn();
+    lane.dec.reserve(2 * DEMOD_HISTORY * sn);
+    lane.dec.assign((DEMOD_HISTORY - 1) * sn, gr_complex(0, 0));
+    lane.dec_start = -(int64_t)lane.dec.size();
+  }
+
+  const uint32_t sn = (uint32_t)std::ceil((double)(1 << sf) * d_fs / d_bw);
+  d_window = DEMOD_HISTORY * sn;
+  log_info("channelized_detector",
+           "{} channels of {} Hz, {} searched on {} threads", d_nchannels,
+           channel_rate, d_lanes.size(), d_pool.size());
+
+  message_port_register_out(pmt::mp("detected"));
+
+  // A lane lags the input by up to a window and a step, plus the delays of
+  // the filterbank and of the resampler: keep that much input so the window
+  // of a detection can still be tagged
+  const polyphase_resampler &r = *d_lanes[0].resampler;
+  set_history(d_window + 2 * sn +
+              d_nchannels * ((uint32_t)std::ceil(r.delay()) + 2) +
+              (uint32_t)std::ceil(d_pfb.delay()));
+  // The filterbank takes whole blocks of one sample per channel
+  set_output_multiple(d_nchannels);
+}
+
+/*
+ * Our virtual destructor.
+ */
+channelized_detector_impl::~channelized_detector_impl() {}
+
+void channelized_detector_impl::forecast(int noutput_items,
+                                         gr_vector_int &ninput_items_required) {
+  ninput_items_required[0] = noutput_items;
+}
+
+int64_t channelized_detector_impl::input_index(const channel_lane &lane,
+                                               int64_t dec_index) const {
+  const polyphase_resampler &r = *lane.resampler;
+  // Resampled sample k stands for channel sample k * M / L - delay, and
+  // channel sample j for the block ending with input j * N + N - 1
+  double c = (double)dec_index * r.decimation() / r.interpolation() - r.delay();
+  return std::llround(c * d_nchannels + d_nchannels - 1 - d_pfb.delay());
+}
+
+void channelized_detector_impl::run_lane(channel_lane &lane, size_t nblocks) {
+  const int sn = lane.sync->sn();
+  const int window = DEMOD_HISTORY * sn;
+  const int max_step = lane.sync->max_step();
+
+  lane.samples.resize(nblocks);
+  for (size_t j = 0; j < nblocks; j++) {
+    lane.samples[j] = d_blocks[j * d_nchannels + lane.channel];
+  }
+  lane.resampler->process(lane.samples.data(), nblocks, lane.dec);
+
+  // Every detection of the call is kept, the tags do not need to stop
+  lane.hits.clear();
+  while (lane.offset + window - 1 + max_step <= (int)lane.dec.size()) {
+    uint32_t num_consumed =
+        lane.sync->step(&lane.dec[lane.offset + sn * (DEMOD_HISTORY - 1)]);
+    if (lane.sync->detected()) {
+      lane.hits.push_back(lane.dec_start + lane.offset);
+      // Skip the detected packet
+      num_consumed = window;
+    }
+    lane.offset += num_consumed;
+  }
+
+  // Drop what the state machine is done with. A skip can go past the
+  // samples we have, the rest of it applies to the next call.
+  size_t done = std::min<size_t>(lane.offset, lane.dec.size());
+  lane.dec.erase(lane.dec.begin(), lane.dec.begin() + done);
+  lane.dec_start += done;
+  lane.offset -= done;
+}
+
+int channelized_detector_impl::general_work(
+    int noutput_items, gr_vector_int &ninput_items,
+    gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+  auto in0 = static_cast<const input_type *>(input_items[0]);
+  auto out = static_cast<output_type *>(output_items[0]);
+  const int first = history() - 1; // First new sample
+
+  // Whole filterbank blocks only; every consumed sample is also produced
+  int nnew = std::min(ninput_items[0] - first, noutput_items);
+  size_t nblocks = nnew > 0 ? nnew / d_nchannels : 0;
+  if (nblocks == 0)
+    return 0; // Not enough input
+  const int num_consumed = nblocks * d_nchannels;
+
+  d_blocks.resize(nblocks * d_nchannels);
+  d_pfb.process(&in0[first], nblocks, d_blocks.data());
+  d_pool.parallel_for(d_lanes.size(),
+                      [&](size_t k) { run_lane(d_lanes[k], nblocks); });
+
+  // The output is the input delayed by the history, out[i] is in0[i]
+  memcpy(out, in0, num_consumed * sizeof(gr_complex));
+  const int64_t in_start = (int64_t)nitems_read(0) - first;
+  for (const channel_lane &lane : d_lanes) {
+    for (int64_t hit : lane.hits) {
+      int64_t start = std::max(input_index(lane, hit), in_start);
+      const uint64_t tag = nitems_written(0) + (start - in_start);
+      add_item_tag(0, tag, pmt::mp("burst_start"), pmt::from_long(d_window),
+                   alias_pmt());
+      add_item_tag(0, tag, pmt::mp("channel"), pmt::from_long(lane.channel),
+                   alias_pmt());
+      d_burst_ends.insert(std::upper_bound(d_burst_ends.begin(),
+                                           d_burst_ends.end(),
+                                           tag + d_window - 1),
+                          tag + d_window - 1);
+
+      int k = lane.channel < (int)(d_nchannels + 1) / 2
+                  ? lane.channel
+                  : lane.channel - (int)d_nchannels;
+      pmt::pmt_t msg = pmt::make_dict();
+      msg = pmt::dict_add(msg, pmt::mp("detected"), pmt::PMT_T);
+      msg = pmt::dict_add(msg, pmt::mp("channel"),
+                          pmt::from_long(lane.channel));
+      msg = pmt::dict_add(msg, pmt::mp("frequency"),
+                          pmt::from_double((double)k * d_fs / d_nchannels));
+      msg = pmt::dict_add(msg, pmt::mp("offset"), pmt::from_long(start));
+      msg = pmt::dict_add(msg, pmt::mp("length"), pmt::from_long(d_window));
+      message_port_pub(pmt::mp("detected"), msg);
+
+      log_info("channelized_detector", "Detected on channel {}",
+               lane.channel);
+    }
+  }
+  // End tags can fall after what this call produces
+  while (!d_burst_ends.empty() &&
+         d_burst_ends.front() < nitems_written(0) + num_consumed) {
+    add_item_tag(0, d_burst_ends.front(), pmt::mp("burst_end"),
+                 pmt::from_long(d_window), alias_pmt());
+    d_burst_ends.pop_front();
+  }
+
+  consume_each(num_consumed);
+  return num_consumed;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_IMPL_H
+#define INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_IMPL_H
+
+#include "pfb_channelizer.h"
+#include "polyphase_resampler.h"
+#include "sync_detector.h"
+#include "worker_pool.h"
+
+#include <gnuradio/first_lora/channelized_detector.h>
+#include <gnuradio/gr_complex.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+class channelized_detector_impl : public channelized_detector {
+private:
+  /**
+   * @brief One channel of the filterbank and its state machine
+   */
+  struct channel_lane {
+    int channel;                                     // Filterbank channel
+    std::unique_ptr<polyphase_resampler> resampler;  // Channel rate to 1x
+    std::unique_ptr<sync_detector> sync;             // Preamble/SFD search
+    std::vector<gr_complex> samples;                 // Channel samples
+    std::vector<gr_complex> dec;     // Resampled samples still needed
+    int64_t dec_start = 0;           // Resampled index of dec[0]
+    int offset = 0;                  // Window start of sync in dec
+    std::vector<int64_t> hits;       // Resampled window starts detected
+  };
+
+  uint32_t d_bw;                     // Bandwidth
+  uint32_t d_fs;                     // Input sampling rate
+  uint32_t d_nchannels;              // Channels of the filterbank
+  uint32_t d_window;                 // DEMOD_HISTORY symbols at d_fs
+  pfb_channelizer d_pfb;             // Wideband input to channels
+  std::vector<gr_complex> d_blocks;  // Filterbank output of a call
+  std::vector<channel_lane> d_lanes; // One lane per searched channel
+  worker_pool d_pool;                // Runs the lanes in parallel
+  std::deque<uint64_t> d_burst_ends; // burst_end tags not yet produced
+
+  /**
+   * @brief Resample the channel of a lane and run its state machine over it
+   * @param lane Lane to run
+   * @param nblocks Filterbank blocks of this call
+   */
+  void run_lane(channel_lane &lane, size_t nblocks);
+
+  /**
+   * @brief Input sample standing for a resampled sample of a lane
+   */
+  int64_t input_index(const channel_lane &lane, int64_t dec_index) const;
+
+public:
+  channelized_detector_impl(uint8_t sf, uint32_t bw, uint32_t samp_rate,
+                            int nchannels, const std::vector<int> &channels,
+                            int method, int nthreads);
+  ~channelized_detector_impl();
+
+  // Where all the action really happens
+  void forecast(int noutput_items, gr_vector_int &ninput_items_required);
+
+  int general_work(int noutput_items, gr_vector_int &ninput_items,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items);
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_CHANNELIZED_DETECTOR_IMPL_H */
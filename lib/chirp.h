@@ -0,0 +1,103 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_CHIRP_H
+#define INCLUDED_FIRST_LORA_CHIRP_H
+
+#include <gnuradio/expj.h>
+#include <gnuradio/gr_complex.h>
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Generate chirp signal
+ * chirp(t;f_0) = A(t)exp(j2π(f_0 + (B/2T)t)t) (where A(t) is the amplitude
+ * envelope, f_0 is the initial frequency, B is the bandwidth, and T is the
+ * chirp period)
+ * The symbol lasts 2^sf * fs / bw samples, fs must be a multiple of bw.
+ * @param sf Spreading factor
+ * @param bw Bandwidth
+ * @param fs Sampling rate
+ * @param upchirp Upchirp or downchirp
+ * @return Chirp signal
+ */
+inline std::vector<gr_complex> g_chirp(uint8_t sf, uint32_t bw, uint32_t fs,
+                                       bool upchirp) {
+  std::vector<gr_complex> chirp;
+  uint32_t n = (1 << sf) * (fs / bw);
+  double T = n / (double)fs;
+  for (ulong i = 0; i < n; i++) {
+    double t = i / (double)fs;
+    double phase = 2 * M_PI * (bw / (2 * T) * t * t);
+    if (!upchirp) {
+      phase = -phase;
+    }
+    chirp.push_back(gr_complex(std::cos(phase), std::sin(phase)));
+  }
+  return chirp;
+}
+
+/**
+ * @brief Generate chirp signal (equivalent method to the traditional one)
+ * @see g_chirp
+ */
+inline std::vector<gr_complex> g_chirp2(uint8_t sf, uint32_t bw, uint32_t fs,
+                                        bool upchirp) {
+  std::vector<gr_complex> chirp;
+  int fsr = (int)fs / bw;
+  uint32_t n = (1 << sf) * fsr;
+  for (ulong i = 0; i < n; i++) {
+    double phase = M_PI / fsr * (i - i * i / (float)n);
+    chirp.push_back(gr_complex(std::polar(1.0, upchirp ? -phase : phase)));
+  }
+  return chirp;
+}
+
+inline std::vector<gr_complex> g_chirp3(uint8_t sf, uint32_t bw, uint32_t fs,
+                                        bool upchirp) {
+  std::vector<gr_complex> chirp;
+  uint32_t n = (1 << sf) * 2;
+  for (ulong i = 0; i < n; i++) {
+    chirp.push_back(gr_complex(1.0, 1.0) *
+                    gr_expj(2.0 * M_PI * 1 / fs * i *
+                            (bw / 2.0 * (-0.5 * bw * n / 2) * 1 / fs * i) *
+                            (upchirp ? 1 : -1.0f)));
+  }
+  return chirp;
+}
+/**
+ * @brief Generate downchirp signal
+ * @param sf Spreading factor
+ * @param bw Bandwidth
+ * @param fs Sampling rate
+ * @return Downchirp signal
+ */
+inline std::vector<gr_complex> g_downchirp(uint8_t sf, uint32_t bw,
+                                           uint32_t fs) {
+  return g_chirp2(sf, bw, fs, false);
+}
+/**
+ * @brief Generate upchirp signal
+ * @param sf Spreading factor
+ * @param bw Bandwidth
+ * @param fs Sampling rate
+ * @return Upchirp signal
+ */
+inline std::vector<gr_complex> g_upchirp(uint8_t sf, uint32_t bw, uint32_t fs) {
+  return g_chirp2(sf, bw, fs, true);
+}
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_CHIRP_H */
@@ -0,0 +1,62 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "chirp_cache.h"
+#include "chirp.h"
+
+#include <volk/volk.h>
+#include <volk/volk_malloc.h>
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <tuple>
+
+namespace gr {
+namespace first_lora {
+
+chirp_table::chirp_table(uint8_t sf, uint32_t bw, uint32_t fs)
+    : sf(sf), bw(bw), fs(fs) {
+  std::vector<gr_complex> u = g_upchirp(sf, bw, fs);
+  std::vector<gr_complex> d = g_downchirp(sf, bw, fs);
+  n = u.size();
+  up = (lv_32fc_t *)volk_malloc(n * sizeof(lv_32fc_t), volk_get_alignment());
+  down = (lv_32fc_t *)volk_malloc(n * sizeof(lv_32fc_t), volk_get_alignment());
+  if (up == NULL || down == NULL) {
+    volk_free(up);
+    volk_free(down);
+    throw std::bad_alloc();
+  }
+  memcpy((void *)up, u.data(), n * sizeof(lv_32fc_t));
+  memcpy((void *)down, d.data(), n * sizeof(lv_32fc_t));
+}
+
+chirp_table::~chirp_table() {
+  volk_free(up);
+  volk_free(down);
+}
+
+std::shared_ptr<const chirp_table> get_chirp_table(uint8_t sf, uint32_t bw,
+                                                   uint32_t fs) {
+  typedef std::tuple<uint8_t, uint32_t, uint32_t> key;
+  static std::mutex lock;
+  static std::map<key, std::weak_ptr<const chirp_table>> cache;
+
+  // Only taken when a detector is built, never on the data path
+  std::lock_guard<std::mutex> guard(lock);
+  std::weak_ptr<const chirp_table> &entry = cache[key(sf, bw, fs)];
+  std::shared_ptr<const chirp_table> table = entry.lock();
+  if (!table) {
+    table = std::make_shared<const chirp_table>(sf, bw, fs);
+    entry = table;
+  }
+  return table;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
@@ -0,0 +1,62 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_CHIRP_CACHE_H
+#define INCLUDED_FIRST_LORA_CHIRP_CACHE_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+#include <volk/volk_complex.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Reference chirps of one (sf, bw, fs), immutable once built
+ */
+struct FIRST_LORA_API chirp_table {
+  uint8_t sf;
+  uint32_t bw;
+  uint32_t fs;
+  uint32_t n;      // Samples per symbol
+  lv_32fc_t *up;   // Upchirp (n, aligned)
+  lv_32fc_t *down; // Downchirp (n, aligned), conjugate of up
+
+  chirp_table(uint8_t sf, uint32_t bw, uint32_t fs);
+  ~chirp_table();
+
+  chirp_table(const chirp_table &) = delete;
+  chirp_table &operator=(const chirp_table &) = delete;
+};
+
+/**
+ * @brief Process wide cache of the reference chirps
+ *
+ * Every detector of the same (sf, bw, fs) shares one table instead of
+ * computing and keeping its own copy. A table lives as long as a detector
+ * uses it and is rebuilt on the next request after that.
+ *
+ * Only the chirps are cached, keyed by (sf, bw, fs): they do not depend on
+ * the padding. FFT plans are not shared, a liquid plan is bound to the
+ * buffers it was created with, so each dechirp_engine keeps its own plan
+ * over its own scratch buffers and can run on its own thread.
+ *
+ * @param sf Spreading factor
+ * @param bw Bandwidth
+ * @param fs Sampling rate
+ * @return Shared table, safe to use from any thread
+ */
+FIRST_LORA_API std::shared_ptr<const chirp_table>
+get_chirp_table(uint8_t sf, uint32_t bw, uint32_t fs);
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_CHIRP_CACHE_H */
@@ -0,0 +1,193 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "control_server.h"
+#include "async_logger.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace gr {
+namespace first_lora {
+
+control_server::control_server(command_handler on_command,
+                               std::function<void()> on_wake)
+    : d_on_command(std::move(on_command)), d_on_wake(std::move(on_wake)) {}
+
+control_server::~control_server() { stop(); }
+
+bool control_server::start(const std::string &address, int port) {
+  // Numeric or /etc/hosts names only, no DNS lookup at start-up
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *res = NULL;
+  const std::string service = std::to_string(port);
+  if (getaddrinfo(address.c_str(), service.c_str(), &hints, &res) != 0) {
+    log_error("control_server", "Cannot resolve the address");
+    return false;
+  }
+  for (struct addrinfo *a = res; a != NULL && d_listen < 0; a = a->ai_next) {
+    int fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 5) == 0) {
+      d_listen = fd;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(res);
+  if (d_listen < 0) {
+    log_error("control_server", "Cannot listen on port {}: {}", port, errno);
+    return false;
+  }
+
+  d_epoll = epoll_create1(EPOLL_CLOEXEC);
+  d_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = d_listen;
+  epoll_ctl(d_epoll, EPOLL_CTL_ADD, d_listen, &ev);
+  ev.data.fd = d_event;
+  epoll_ctl(d_epoll, EPOLL_CTL_ADD, d_event, &ev);
+
+  d_stop = false;
+  d_thread = std::thread(&control_server::loop, this);
+  log_info("control_server", "Listening on port {}", port);
+  return true;
+}
+
+void control_server::stop() {
+  if (d_thread.joinable()) {
+    d_stop = true;
+    wake();
+    d_thread.join();
+  }
+  for (int fd : {d_listen, d_event, d_epoll}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  d_listen = d_event = d_epoll = -1;
+}
+
+void control_server::wake() {
+  uint64_t v = 1;
+  if (d_event >= 0 && write(d_event, &v, sizeof(v)) < 0) {
+    log_error("control_server", "Cannot wake the server thread: {}", errno);
+  }
+}
+
+void control_server::loop() {
+  struct epoll_event events[CONTROL_MAX_EVENTS];
+  while (!d_stop) {
+    int n = epoll_wait(d_epoll, events, CONTROL_MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR) {
+      log_error("control_server", "epoll_wait failed: {}", errno);
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == d_listen) {
+        accept_clients();
+      } else if (fd == d_event) {
+        uint64_t v;
+        if (read(d_event, &v, sizeof(v)) == sizeof(v)) {
+          d_on_wake();
+        }
+      } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_client(fd);
+      }
+    }
+  }
+  drop_clients();
+}
+
+void control_server::accept_clients() {
+  while (true) {
+    int fd = accept4(d_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return; // EAGAIN: no one else waiting
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+    epoll_ctl(d_epoll, EPOLL_CTL_ADD, fd, &ev);
+    d_clients.insert(fd);
+    log_info("control_server", "Client connected");
+  }
+}
+
+void control_server::read_client(int fd) {
+  if (d_clients.count(fd) == 0) {
+    return;
+  }
+  char buf[CONTROL_MAX_MESSAGE];
+  ssize_t n = read(fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (n <= 0) {
+    drop_client(fd);
+    return;
+  }
+
+  // Lines are commands, and so is what is left at the end of the chunk
+  const std::string chunk(buf, n);
+  size_t start = 0;
+  while (start < chunk.size()) {
+    size_t end = chunk.find('\n', start);
+    if (end == std::string::npos) {
+      end = chunk.size();
+    }
+    std::string cmd = chunk.substr(start, end - start);
+    start = end + 1;
+    size_t first = cmd.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+      continue;
+    }
+    cmd = cmd.substr(first, cmd.find_last_not_of(" \t\r") - first + 1);
+    std::string reply = d_on_command(cmd);
+    if (!reply.empty() && send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) {
+      drop_client(fd);
+      return;
+    }
+  }
+}
+
+void control_server::drop_client(int fd) {
+  epoll_ctl(d_epoll, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  d_clients.erase(fd);
+  log_info("control_server", "Client disconnected");
+}
+
+void control_server::drop_clients() {
+  while (!d_clients.empty()) {
+    drop_client(*d_clients.begin());
+  }
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
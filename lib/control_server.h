@@ -0,0 +1,83 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_CONTROL_SERVER_H
+#define INCLUDED_FIRST_LORA_CONTROL_SERVER_H
+
+#include <gnuradio/first_lora/api.h>
+
+#include <atomic>
+#include <functional>
+#include <set>
+#include <string>
+#include <thread>
+
+#define CONTROL_MAX_EVENTS 16   // epoll events handled per wake up
+#define CONTROL_MAX_MESSAGE 1024 // Bytes read from a client at a time
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Line based TCP control channel served by one epoll thread
+ *
+ * Any number of clients can connect. A command is a line of text; a chunk
+ * received without a newline is taken as a whole command too, as the
+ * loopback clients of file_writer send them. Every command is passed to
+ * the handler and its reply, if not empty, is sent back.
+ *
+ * Nothing blocks the caller: the socket is bound by start() and accepting,
+ * reading and replying all happen on the server thread. wake() runs the
+ * wake handler on the server thread, for work handed over by other threads.
+ */
+class FIRST_LORA_API control_server {
+public:
+  /** @brief Reply to a command ("" for none) */
+  typedef std::function<std::string(const std::string &)> command_handler;
+
+private:
+  command_handler d_on_command;
+  std::function<void()> d_on_wake;
+  int d_epoll = -1;
+  int d_listen = -1;
+  int d_event = -1;                    // eventfd of wake() and stop()
+  std::atomic<bool> d_stop{false};     // Server thread must return
+  std::set<int> d_clients;             // Client sockets
+  std::thread d_thread;
+
+  void loop();
+  void accept_clients();
+  void read_client(int fd);
+  void drop_client(int fd);
+
+public:
+  control_server(command_handler on_command, std::function<void()> on_wake);
+  ~control_server();
+
+  control_server(const control_server &) = delete;
+  control_server &operator=(const control_server &) = delete;
+
+  /**
+   * @brief Listen on address:port and start the server thread
+   * @return false if the socket cannot be bound
+   */
+  bool start(const std::string &address, int port);
+
+  /** @brief Close every connection and join the server thread */
+  void stop();
+
+  /** @brief Run the wake handler on the server thread (any thread) */
+  void wake();
+
+  /** @brief Close every client connection (server thread) */
+  void drop_clients();
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_CONTROL_SERVER_H */
@@ -0,0 +1,271 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "dechirp_engine.h"
+#include "detector_kernels.h"
+
+#include <volk/volk.h>
+#include <volk/volk_malloc.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+template <typename T> static T *aligned_alloc_zero(size_t n) {
+  T *p = (T *)volk_malloc(n * sizeof(T), volk_get_alignment());
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  memset((void *)p, 0, n * sizeof(T));
+  return p;
+}
+
+dechirp_engine::dechirp_engine(uint32_t sn, uint32_t fft_size,
+                               uint32_t bin_size,
+                               std::shared_ptr<const chirp_table> chirps,
+                               uint32_t peak_bins)
+    : d_sn(sn), d_fft_size(fft_size), d_bin_size(bin_size),
+      d_peak_bins(peak_bins ? peak_bins : bin_size),
+      d_chirps(std::move(chirps)) {
+  if (d_chirps->n != d_sn) {
+    throw std::invalid_argument("dechirp_engine: chirps are not sn samples");
+  }
+  // The chirps are shared with every engine of the same SF, only read here
+  d_ref_downchirp = d_chirps->down;
+  d_ref_upchirp = d_chirps->up;
+  d_conj_refs = true;
+  for (uint32_t i = 0; i < d_sn && d_conj_refs; i++) {
+    d_conj_refs = d_ref_upchirp[i] == std::conj(d_ref_downchirp[i]);
+  }
+
+  // The zero padding is written once here: dechirp() only ever touches the
+  // first d_sn samples and the FFT is out of place, so the tail stays zero.
+  // Each buffer holds two symbols so dechirp_dual() can keep both spectra
+  // side by side.
+  d_fft_in = aligned_alloc_zero<lv_32fc_t>(2 * d_fft_size);
+  d_fft_out = aligned_alloc_zero<lv_32fc_t>(2 * d_fft_size);
+  d_folded = aligned_alloc_zero<float>(d_bin_size);
+
+  d_plan = fft_create_plan(d_fft_size, d_fft_in, d_fft_out, LIQUID_FFT_FORWARD,
+                           0);
+  d_plan_down = fft_create_plan(d_fft_size, d_fft_in + d_fft_size,
+                                d_fft_out + d_fft_size, LIQUID_FFT_FORWARD, 0);
+}
+
+dechirp_engine::~dechirp_engine() {
+  fft_destroy_plan(d_plan);
+  fft_destroy_plan(d_plan_down);
+  volk_free(d_fft_in);
+  volk_free(d_fft_out);
+  volk_free(d_folded);
+}
+
+uint32_t dechirp_engine::argmax_32f(const float *x, float *max, uint32_t n) {
+  // The inputs are magnitudes, already positive
+  float m = x[0];
+  uint32_t index = 0;
+
+  for (uint32_t i = 1; i < n; i++) {
+    if (x[i] > m) {
+      m = x[i];
+      index = i;
+    }
+  }
+
+  *max = m;
+  return index;
+}
+
+float dechirp_engine::interpolate_peak(const float *x, uint32_t peak,
+                                       uint32_t n) {
+  float y0 = x[(peak + n - 1) % n];
+  float y1 = x[peak];
+  float y2 = x[(peak + 1) % n];
+  float denom = y0 - 2 * y1 + y2;
+  if (denom >= 0) {
+    return 0; // Flat or not a maximum
+  }
+  float delta = 0.5f * (y0 - y2) / denom;
+  return std::min(0.5f, std::max(-0.5f, delta));
+}
+
+uint32_t dechirp_engine::get_fft_peak_abs(const lv_32fc_t *fft_r, float *b2,
+                                          float *max) {
+  // Add the magnitude of the last part of the FFT to the first part.
+  // This is the CPA proposed in the paper to determine the phase misalignment
+  // (magnitude, fold and argmax in a single pass)
+  return cpa_peak_32fc(fft_r, &fft_r[d_fft_size - d_bin_size], d_bin_size, b2,
+                       max);
+}
+
+uint32_t dechirp_engine::get_fft_peak_phase(const lv_32fc_t *fft_r,
+                                            float *max) {
+  // This is the FPA proposed in the paper to determine the phase misalignment.
+  // The 4 rotations are evaluated together, bin by bin.
+  return fpa_peak_32fc(fft_r, &fft_r[d_fft_size - d_bin_size], d_bin_size,
+                       max);
+}
+
+std::pair<float, uint32_t> dechirp_engine::dechirp(const gr_complex *in,
+                                                   bool is_up, uint32_t phase) {
+  // Dechirp https://dl.acm.org/doi/10.1145/3546869#d1e1181
+  // straight into the (already zero padded) FFT input. The reference is
+  // periodic: from phase to its end, then from its start.
+  const lv_32fc_t *ref = is_up ? d_ref_downchirp : d_ref_upchirp;
+  phase %= d_sn;
+  volk_32fc_x2_multiply_32fc(d_fft_in, in, &ref[phase], d_sn - phase);
+  if (phase > 0) {
+    volk_32fc_x2_multiply_32fc(&d_fft_in[d_sn - phase], &in[d_sn - phase], ref,
+                               phase);
+  }
+
+  // FFT
+  fft_execute(d_plan);
+
+  // Get peak of FFT
+  float max;
+  uint32_t peak = find_peak(d_fft_out, &max);
+
+  return std::make_pair(max, peak);
+}
+
+const gr_complex *dechirp_engine::load_16sc(const lv_16sc_t *in) {
+  // Interleaved I/Q: 2 * d_sn int16 to as many floats
+  volk_16i_s32f_convert_32f((float *)d_fft_in, (const int16_t *)in, SC16_SCALE,
+                            2 * d_sn);
+  return d_fft_in;
+}
+
+std::pair<float, uint32_t> dechirp_engine::dechirp(const lv_16sc_t *in,
+                                                   bool is_up, uint32_t phase) {
+  // Each sample is multiplied where it lies, the two parts of a rotated
+  // reference do not overlap
+  return dechirp(load_16sc(in), is_up, phase);
+}
+
+dechirp_engine::dual_peak dechirp_engine::dechirp_dual(const lv_16sc_t *in) {
+  // The downchirp product is written first, the upchirp one in place
+  return dechirp_dual(load_16sc(in));
+}
+
+uint32_t dechirp_engine::find_peak(const lv_32fc_t *spectrum, float *max) {
+  uint32_t peak;
+  if (d_peak_method == peak_method::FPA) {
+    peak = get_fft_peak_phase(spectrum, max);
+  } else {
+    peak = get_fft_peak_abs(spectrum, NULL, max);
+  }
+  return to_peak_bins(spectrum, peak);
+}
+
+uint32_t dechirp_engine::to_peak_bins(const lv_32fc_t *spectrum,
+                                      uint32_t peak) const {
+  if (d_peak_bins == d_bin_size) {
+    return peak;
+  }
+  // Less zero padding than the requested resolution: refine the coarse
+  // argmax between bins and rescale it. The folded spectrum is not kept, only
+  // the two neighbours of the peak are rebuilt.
+  const lv_32fc_t *tail = &spectrum[d_fft_size - d_bin_size];
+  float y[3];
+  for (uint32_t j = 0; j < 3; j++) {
+    uint32_t k = (peak + d_bin_size - 1 + j) % d_bin_size;
+    y[j] = d_peak_method == peak_method::FPA
+               ? std::sqrt(fpa_power_32fc(spectrum[k], tail[k]))
+               : std::abs(spectrum[k]) + std::abs(tail[k]);
+  }
+  float delta = interpolate_peak(y, 1, 3);
+  float scaled = std::round((peak + delta) * d_peak_bins / d_bin_size);
+  return ((int64_t)scaled + d_peak_bins) % d_peak_bins;
+}
+
+uint32_t dechirp_engine::find_peaks(uint32_t max_peaks, uint32_t min_distance,
+                                    float min_ratio, spectrum_peak *peaks,
+                                    bool down) {
+  const lv_32fc_t *spectrum = down ? &d_fft_out[d_fft_size] : d_fft_out;
+  const lv_32fc_t *tail = &spectrum[d_fft_size - d_bin_size];
+  float max;
+  if (d_peak_method == peak_method::FPA) {
+    for (uint32_t k = 0; k < d_bin_size; k++) {
+      d_folded[k] = std::sqrt(fpa_power_32fc(spectrum[k], tail[k]));
+    }
+  } else {
+    cpa_peak_32fc(spectrum, tail, d_bin_size, d_folded, &max);
+  }
+
+  // Few peaks are asked for: one argmax per peak is cheaper than sorting
+  // every local maximum. The refinement reads the spectrum, not the fold,
+  // so it does not see the bins already cleared.
+  uint32_t found = 0;
+  while (found < max_peaks) {
+    uint32_t peak = argmax_32f(d_folded, &max, d_bin_size);
+    if (max <= 0 || (found > 0 && max < min_ratio * peaks[0].val)) {
+      break;
+    }
+    peaks[found].val = max;
+    peaks[found].idx = to_peak_bins(spectrum, peak);
+    found++;
+    for (uint32_t d = 0; d <= min_distance && d < d_bin_size; d++) {
+      d_folded[(peak + d) % d_bin_size] = 0;
+      d_folded[(peak + d_bin_size - d) % d_bin_size] = 0;
+    }
+  }
+  if (found == 0) {
+    // Nothing but zeros, like dechirp() report bin zero
+    peaks[0].val = 0;
+    peaks[0].idx = 0;
+    found = 1;
+  }
+  return found;
+}
+
+dechirp_engine::dual_peak dechirp_engine::dechirp_dual(const gr_complex *in) {
+  lv_32fc_t *up_in = d_fft_in;
+  lv_32fc_t *down_in = d_fft_in + d_fft_size;
+
+  if (d_conj_refs) {
+    // With c the upchirp, in * conj(c) and in * c share their four partial
+    // products: (ac + bd) + j(bc - ad) and (ac - bd) + j(ad + bc)
+    const float *x = (const float *)in;
+    const float *c = (const float *)d_ref_upchirp;
+    float *u = (float *)up_in;
+    float *d = (float *)down_in;
+    for (uint32_t i = 0; i < 2 * d_sn; i += 2) {
+      float ac = x[i] * c[i];
+      float bd = x[i + 1] * c[i + 1];
+      float ad = x[i] * c[i + 1];
+      float bc = x[i + 1] * c[i];
+      u[i] = ac + bd;
+      u[i + 1] = bc - ad;
+      d[i] = ac - bd;
+      d[i + 1] = ad + bc;
+    }
+  } else {
+    // in may be up_in (int16 input): the downchirp product goes first
+    volk_32fc_x2_multiply_32fc(down_in, in, d_ref_upchirp, d_sn);
+    volk_32fc_x2_multiply_32fc(up_in, in, d_ref_downchirp, d_sn);
+  }
+
+  // Two transforms: the products are not conjugate or mirrored versions of
+  // each other, so one spectrum cannot be derived from the other
+  fft_execute(d_plan);
+  fft_execute(d_plan_down);
+
+  // Each peak search is a single pass over its spectrum
+  dual_peak p;
+  p.up_idx = find_peak(d_fft_out, &p.up_val);
+  p.down_idx = find_peak(&d_fft_out[d_fft_size], &p.down_val);
+  return p;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
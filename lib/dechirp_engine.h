@@ -0,0 +1,226 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_DECHIRP_ENGINE_H
+#define INCLUDED_FIRST_LORA_DECHIRP_ENGINE_H
+
+#include "chirp_cache.h"
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+#include <liquid/liquid.h>
+#include <volk/volk_complex.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+#define SC16_SCALE 32768.0f // Complex int16 sample of amplitude 1
+
+/**
+ * @brief How the two ends of the zero padded spectrum are combined
+ */
+enum class peak_method {
+  CPA, // Coarse phase alignment: |head| + |tail|
+  FPA, // Fine phase alignment: best of |head * r + tail|, r in {1, j, -1, -j}
+};
+
+/**
+ * @brief Dechirp, zero-padded FFT and peak search of a LoRa symbol
+ *
+ * The FFT plan and every scratch buffer are set up once in the constructor
+ * and reused for each symbol, so dechirp() does no heap allocation and no
+ * plan creation. The reference chirps are read from a table shared by every
+ * engine of the same SF.
+ *
+ * The plans stay per engine: a liquid plan is bound to its input and output
+ * buffers, so two engines (possibly on two threads) cannot share one.
+ */
+class FIRST_LORA_API dechirp_engine {
+private:
+  uint32_t d_sn;             // Number of samples per symbol
+  uint32_t d_fft_size;       // FFT size (zero padded)
+  uint32_t d_bin_size;       // Bin size (d_fft_size / 2)
+  uint32_t d_peak_bins;      // Resolution of the reported peak
+  std::shared_ptr<const chirp_table> d_chirps; // Shared reference chirps
+  const lv_32fc_t *d_ref_downchirp; // Downchirp reference signal
+  const lv_32fc_t *d_ref_upchirp;   // Upchirp reference signal
+  bool d_conj_refs;           // The upchirp is the conjugate of the downchirp
+  lv_32fc_t *d_fft_in;        // FFT input, only the first d_sn are written
+                              // (2 * d_fft_size, second half for dechirp_dual)
+  lv_32fc_t *d_fft_out;       // FFT result (2 * d_fft_size)
+  float *d_folded;            // Folded magnitude of find_peaks() (d_bin_size)
+  fftplan d_plan;             // FFT plan (d_fft_in -> d_fft_out)
+  fftplan d_plan_down;        // FFT plan of the second halves
+  peak_method d_peak_method = peak_method::CPA; // Peak search of dechirp()
+
+  /**
+   * @brief Refine a peak between bins and rescale it to d_peak_bins
+   * @param spectrum FFT result the peak was found in
+   * @param peak Coarse peak index in [0, d_bin_size)
+   * @return Peak index in [0, d_peak_bins)
+   */
+  uint32_t to_peak_bins(const lv_32fc_t *spectrum, uint32_t peak) const;
+
+  /**
+   * @brief Peak of a spectrum with the selected peak method
+   * @param spectrum FFT result (d_fft_size)
+   * @param max Peak value
+   * @return Peak index in [0, d_peak_bins)
+   */
+  uint32_t find_peak(const lv_32fc_t *spectrum, float *max);
+
+  /**
+   * @brief Convert a complex int16 symbol into the FFT input
+   * Scaled by 1 / SC16_SCALE, so both input types see the same values. The
+   * float versions then dechirp the FFT input in place.
+   * @param in Symbol samples (d_sn)
+   * @return FFT input holding the symbol
+   */
+  const gr_complex *load_16sc(const lv_16sc_t *in);
+
+public:
+  /**
+   * @brief Build the plan and scratch buffers
+   * @param sn Number of samples per symbol
+   * @param fft_size FFT size (>= sn)
+   * @param bin_size Number of bins kept after folding
+   * @param chirps Reference chirps (sn samples, see get_chirp_table())
+   * @param peak_bins Number of bins the peak is reported in. When it differs
+   *                  from bin_size, the peak is interpolated between FFT bins
+   *                  (0: bin_size, no interpolation)
+   */
+  dechirp_engine(uint32_t sn, uint32_t fft_size, uint32_t bin_size,
+                 std::shared_ptr<const chirp_table> chirps,
+                 uint32_t peak_bins = 0);
+  ~dechirp_engine();
+
+  dechirp_engine(const dechirp_engine &) = delete;
+  dechirp_engine &operator=(const dechirp_engine &) = delete;
+
+  /**
+   * @brief Dechirp one symbol and get the peak of its spectrum
+   * @param in Symbol samples (d_sn)
+   * @param is_up Dechirp an upchirp (multiply by the downchirp) or a downchirp
+   * @param phase Sample of the reference chirp the first sample is multiplied
+   *              with. Windows overlapping by a part of a symbol see a
+   *              chirp at the same bin when phase follows their start.
+   * @return (peak value, peak index in [0, peak_bins))
+   */
+  std::pair<float, uint32_t> dechirp(const gr_complex *in, bool is_up,
+                                     uint32_t phase = 0);
+
+  /** @brief dechirp() of complex int16 samples */
+  std::pair<float, uint32_t> dechirp(const lv_16sc_t *in, bool is_up,
+                                     uint32_t phase = 0);
+
+  /**
+   * @brief Peaks of one symbol dechirped as an upchirp and as a downchirp
+   */
+  struct dual_peak {
+    float up_val;      // Peak value with the downchirp (upchirp symbol)
+    uint32_t up_idx;   // Peak index of the upchirp symbol
+    float down_val;    // Peak value with the upchirp (downchirp symbol)
+    uint32_t down_idx; // Peak index of the downchirp symbol
+  };
+
+  /**
+   * @brief A peak of a folded spectrum
+   */
+  struct spectrum_peak {
+    float val;    // Peak value, as returned by dechirp()
+    uint32_t idx; // Peak index in [0, peak_bins)
+  };
+
+  /**
+   * @brief Strongest well separated peaks of the last spectrum
+   * Folds the spectrum with the selected peak method and takes the argmax
+   * again and again, each time clearing min_distance bins on both sides of
+   * the peak taken, so the side lobes of a peak are never reported as
+   * another one. Peaks weaker than min_ratio times the first are dropped.
+   * @param max_peaks Most peaks to report
+   * @param min_distance Smallest distance between two peaks, in bins of
+   *                     the FFT (bin_size)
+   * @param min_ratio Weakest peak value kept, relative to the strongest
+   * @param peaks Peaks found, strongest first (max_peaks)
+   * @param down Spectrum of the downchirp of dechirp_dual() instead of the
+   *             one of dechirp()
+   * @return Number of peaks found, at least 1
+   */
+  uint32_t find_peaks(uint32_t max_peaks, uint32_t min_distance,
+                      float min_ratio, spectrum_peak *peaks,
+                      bool down = false);
+
+  /**
+   * @brief Same as dechirp(in, true) and dechirp(in, false) in one pass
+   * The input is read once for both products (sharing the partial products
+   * when the reference chirps are conjugate) and both spectra are computed
+   * in adjacent buffers.
+   * @param in Symbol samples (d_sn)
+   * @return Peaks of both dechirps
+   */
+  dual_peak dechirp_dual(const gr_complex *in);
+
+  /** @brief dechirp_dual() of complex int16 samples */
+  dual_peak dechirp_dual(const lv_16sc_t *in);
+
+  /**
+   * @brief Get peak of FFT using ABS comparaison
+   * Single pass over the spectrum, see cpa_peak_32fc()
+   * @param fft_r FFT result
+   * @param b2 Folded magnitude (d_bin_size), may be NULL
+   * @param max Maximum value
+   * @return Peak of FFT
+   */
+  uint32_t get_fft_peak_abs(const lv_32fc_t *fft_r, float *b2, float *max);
+
+  /**
+   * @brief Get peak of FFT using its phase
+   * Single pass over the 4 rotations, see fpa_peak_32fc()
+   * @param fft_r FFT result
+   * @param max Maximum value
+   * @return Peak of FFT
+   */
+  uint32_t get_fft_peak_phase(const lv_32fc_t *fft_r, float *max);
+
+  /**
+   * @brief Sub-bin position of a peak
+   * Fits a parabola through the peak and its two (circular) neighbours.
+   * @param x Array
+   * @param peak Index of the maximum of x
+   * @param n Length of array
+   * @return Offset from peak, in [-0.5, 0.5]
+   */
+  static float interpolate_peak(const float *x, uint32_t peak, uint32_t n);
+
+  /**
+   * @brief Get maximum value of array
+   * @param x Array
+   * @param max Maximum value
+   * @param n Length of array
+   * @return Maximum value
+   */
+  static uint32_t argmax_32f(const float *x, float *max, uint32_t n);
+
+  uint32_t sn() const { return d_sn; }
+  uint32_t fft_size() const { return d_fft_size; }
+  uint32_t bin_size() const { return d_bin_size; }
+  uint32_t peak_bins() const { return d_peak_bins; }
+  peak_method get_peak_method() const { return d_peak_method; }
+  /** @brief Select the peak search of dechirp() and dechirp_dual() */
+  void set_peak_method(peak_method method) { d_peak_method = method; }
+  /** @brief FFT result of the last dechirp() (upchirp of dechirp_dual()) */
+  const lv_32fc_t *fft_result() const { return d_fft_out; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_DECHIRP_ENGINE_H */
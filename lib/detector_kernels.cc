@@ -0,0 +1,284 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "detector_kernels.h"
+
+#include <volk/volk.h>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIRST_LORA_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace gr {
+namespace first_lora {
+
+float max_amplitude_32fc(const gr_complex *in, uint32_t n) {
+  float max_amplitude = 0.0;
+  for (uint32_t i = 0; i < n; i++) {
+    // Compute the amplitude of the received sample
+    float amplitude = std::abs(in[i]);
+
+    if (amplitude > max_amplitude) {
+      max_amplitude = amplitude;
+    }
+  }
+  return max_amplitude;
+}
+
+int64_t energy_crossing_32fc(const gr_complex *in, uint32_t n, uint32_t w,
+                             uint32_t first, float threshold, float *scratch,
+                             uint32_t scratch_len) {
+  if (w == 0 || first + 1 < w || first >= n) {
+    return -1;
+  }
+  const uint32_t half = scratch_len / 2;
+  float *lead = scratch;         // Powers entering the window
+  float *trail = scratch + half; // Powers leaving the window
+
+  // Energy of the first window. The running sum is kept in double so it does
+  // not drift over long buffers.
+  double sum = 0;
+  for (uint32_t s = first + 1 - w; s <= first; s += half) {
+    uint32_t len = std::min(half, first + 1 - s);
+    volk_32fc_magnitude_squared_32f(lead, &in[s], len);
+    for (uint32_t i = 0; i < len; i++) {
+      sum += lead[i];
+    }
+  }
+
+  uint32_t pos = first;
+  if (sum >= threshold) {
+    return pos;
+  }
+  while (pos + 1 < n) {
+    uint32_t len = std::min(half, n - 1 - pos);
+    volk_32fc_magnitude_squared_32f(lead, &in[pos + 1], len);
+    volk_32fc_magnitude_squared_32f(trail, &in[pos + 1 - w], len);
+    for (uint32_t i = 0; i < len; i++) {
+      sum += (double)lead[i] - trail[i];
+      if (sum >= threshold) {
+        return pos + 1 + i;
+      }
+    }
+    pos += len;
+  }
+  return -1;
+}
+
+/*
+ * Every kernel below has a portable version and, on x86, an AVX2 one picked
+ * at run time. The SIMD versions keep one running maximum and its index per
+ * lane and reduce them at the end; the comparisons are strict so the first
+ * maximum wins, as with the portable versions.
+ */
+
+typedef uint32_t (*cpa_peak_fn)(const gr_complex *, const gr_complex *,
+                                uint32_t, float *, float *);
+typedef uint32_t (*fpa_peak_fn)(const gr_complex *, const gr_complex *,
+                                uint32_t, float *);
+
+static uint32_t cpa_peak_generic(const gr_complex *head,
+                                 const gr_complex *tail, uint32_t n,
+                                 float *fold, float *max) {
+  float best = -1;
+  uint32_t peak = 0;
+  for (uint32_t k = 0; k < n; k++) {
+    float v = std::sqrt(head[k].real() * head[k].real() +
+                        head[k].imag() * head[k].imag()) +
+              std::sqrt(tail[k].real() * tail[k].real() +
+                        tail[k].imag() * tail[k].imag());
+    if (fold) {
+      fold[k] = v;
+    }
+    if (v > best) {
+      best = v;
+      peak = k;
+    }
+  }
+  *max = std::max(best, 0.0f);
+  return peak;
+}
+
+static uint32_t fpa_peak_generic(const gr_complex *head,
+                                 const gr_complex *tail, uint32_t n,
+                                 float *max) {
+  float best = -1;
+  uint32_t peak = 0;
+  for (uint32_t k = 0; k < n; k++) {
+    float p = fpa_power_32fc(head[k], tail[k]);
+    if (p > best) {
+      best = p;
+      peak = k;
+    }
+  }
+  *max = std::sqrt(std::max(best, 0.0f));
+  return peak;
+}
+
+#ifdef FIRST_LORA_X86_DISPATCH
+/**
+ * @brief Reduce the per lane maxima of an AVX2 argmax
+ * @return Index of the largest value (smallest index on ties)
+ */
+__attribute__((target("avx2"))) static uint32_t
+argmax_reduce_avx2(__m256 vbest, __m256i vidx, float *best) {
+  alignas(32) float v[8];
+  alignas(32) uint32_t idx[8];
+  _mm256_store_ps(v, vbest);
+  _mm256_store_si256((__m256i *)idx, vidx);
+  uint32_t peak = idx[0];
+  *best = v[0];
+  for (int i = 1; i < 8; i++) {
+    if (v[i] > *best || (v[i] == *best && idx[i] < peak)) {
+      *best = v[i];
+      peak = idx[i];
+    }
+  }
+  return peak;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+cpa_peak_avx2(const gr_complex *head, const gr_complex *tail, uint32_t n,
+              float *fold, float *max) {
+  const float *a = (const float *)head;
+  const float *b = (const float *)tail;
+  const __m256i step = _mm256_set1_epi32(8);
+  __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 vbest = _mm256_set1_ps(-1.0f);
+  __m256i vidx = _mm256_setzero_si256();
+
+  uint32_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 a0 = _mm256_loadu_ps(a + 2 * k);
+    __m256 a1 = _mm256_loadu_ps(a + 2 * k + 8);
+    __m256 b0 = _mm256_loadu_ps(b + 2 * k);
+    __m256 b1 = _mm256_loadu_ps(b + 2 * k + 8);
+    // re^2 + im^2 of 8 bins, in the order 0 1 4 5 2 3 6 7
+    __m256 pa = _mm256_hadd_ps(_mm256_mul_ps(a0, a0), _mm256_mul_ps(a1, a1));
+    __m256 pb = _mm256_hadd_ps(_mm256_mul_ps(b0, b0), _mm256_mul_ps(b1, b1));
+    __m256 v = _mm256_add_ps(_mm256_sqrt_ps(pa), _mm256_sqrt_ps(pb));
+    // Back to 0 1 2 3 4 5 6 7
+    v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v),
+                                               _MM_SHUFFLE(3, 1, 2, 0)));
+    if (fold) {
+      _mm256_storeu_ps(fold + k, v);
+    }
+
+    __m256 gt = _mm256_cmp_ps(v, vbest, _CMP_GT_OQ);
+    vbest = _mm256_blendv_ps(vbest, v, gt);
+    vidx = _mm256_blendv_epi8(vidx, idx, _mm256_castps_si256(gt));
+    idx = _mm256_add_epi32(idx, step);
+  }
+
+  float best;
+  uint32_t peak = argmax_reduce_avx2(vbest, vidx, &best);
+  float rest;
+  uint32_t rest_peak =
+      cpa_peak_generic(head + k, tail + k, n - k, fold ? fold + k : NULL, &rest);
+  if (k < n && rest > best) {
+    best = rest;
+    peak = k + rest_peak;
+  }
+  *max = std::max(best, 0.0f);
+  return peak;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+fpa_peak_avx2(const gr_complex *head, const gr_complex *tail, uint32_t n,
+              float *max) {
+  const float *a = (const float *)head;
+  const float *b = (const float *)tail;
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256i step = _mm256_set1_epi32(8);
+  // Deinterleaving 8 complex with shuffle_ps leaves them in this order
+  __m256i idx = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+  __m256 vbest = _mm256_set1_ps(-1.0f);
+  __m256i vidx = _mm256_setzero_si256();
+
+  uint32_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 a0 = _mm256_loadu_ps(a + 2 * k);
+    __m256 a1 = _mm256_loadu_ps(a + 2 * k + 8);
+    __m256 b0 = _mm256_loadu_ps(b + 2 * k);
+    __m256 b1 = _mm256_loadu_ps(b + 2 * k + 8);
+    __m256 ar = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 ai = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+    __m256 br = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 bi = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1));
+
+    // |a|^2 + |b|^2 + 2 * max(|Re(a conj(b))|, |Im(a conj(b))|)
+    __m256 pow = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(ar, ar), _mm256_mul_ps(ai, ai)),
+        _mm256_add_ps(_mm256_mul_ps(br, br), _mm256_mul_ps(bi, bi)));
+    __m256 pr = _mm256_add_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+    __m256 pi = _mm256_sub_ps(_mm256_mul_ps(ai, br), _mm256_mul_ps(ar, bi));
+    __m256 cross = _mm256_max_ps(_mm256_andnot_ps(sign, pr),
+                                 _mm256_andnot_ps(sign, pi));
+    __m256 p = _mm256_add_ps(pow, _mm256_add_ps(cross, cross));
+
+    __m256 gt = _mm256_cmp_ps(p, vbest, _CMP_GT_OQ);
+    vbest = _mm256_blendv_ps(vbest, p, gt);
+    vidx = _mm256_blendv_epi8(vidx, idx, _mm256_castps_si256(gt));
+    idx = _mm256_add_epi32(idx, step);
+  }
+
+  float best;
+  uint32_t peak = argmax_reduce_avx2(vbest, vidx, &best);
+  for (; k < n; k++) {
+    float p = fpa_power_32fc(head[k], tail[k]);
+    if (p > best) {
+      best = p;
+      peak = k;
+    }
+  }
+  *max = std::sqrt(std::max(best, 0.0f));
+  return peak;
+}
+
+static bool cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static cpa_peak_fn select_cpa_peak() {
+#ifdef FIRST_LORA_X86_DISPATCH
+  if (cpu_has_avx2()) {
+    return cpa_peak_avx2;
+  }
+#endif
+  return cpa_peak_generic;
+}
+
+static fpa_peak_fn select_fpa_peak() {
+#ifdef FIRST_LORA_X86_DISPATCH
+  if (cpu_has_avx2()) {
+    return fpa_peak_avx2;
+  }
+#endif
+  return fpa_peak_generic;
+}
+
+uint32_t cpa_peak_32fc(const gr_complex *head, const gr_complex *tail,
+                       uint32_t n, float *fold, float *max) {
+  static const cpa_peak_fn impl = select_cpa_peak();
+  return impl(head, tail, n, fold, max);
+}
+
+uint32_t fpa_peak_32fc(const gr_complex *head, const gr_complex *tail,
+                       uint32_t n, float *max) {
+  static const fpa_peak_fn impl = select_fpa_peak();
+  return impl(head, tail, n, max);
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
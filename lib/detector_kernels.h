@@ -0,0 +1,100 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_DETECTOR_KERNELS_H
+#define INCLUDED_FIRST_LORA_DETECTOR_KERNELS_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Largest amplitude of a block of samples (threshold method)
+ * @param in Samples
+ * @param n Number of samples
+ * @return max |in[i]|
+ */
+FIRST_LORA_API float max_amplitude_32fc(const gr_complex *in, uint32_t n);
+
+/**
+ * @brief First window of a sliding-window energy detector
+ * Slides a window of w samples over in, one sample at a time, and returns the
+ * end of the first window whose energy (sum of |in|^2) reaches threshold.
+ * The powers are computed in chunks with VOLK and the window energy is kept
+ * as a running sum, so every position costs one add and one subtract.
+ * @param in Samples (n)
+ * @param n Number of samples
+ * @param w Window length
+ * @param first End of the first window evaluated (>= w - 1)
+ * @param threshold Energy threshold
+ * @param scratch Scratch buffer (scratch_len, at least 2)
+ * @param scratch_len Length of scratch
+ * @return End of the first window above the threshold, -1 if there is none
+ */
+FIRST_LORA_API int64_t energy_crossing_32fc(const gr_complex *in, uint32_t n,
+                                            uint32_t w, uint32_t first,
+                                            float threshold, float *scratch,
+                                            uint32_t scratch_len);
+
+/**
+ * @brief CPA peak search of a zero padded spectrum
+ * Folds the tail of the spectrum onto its head, |head[k]| + |tail[k]|, and
+ * finds the first maximum in a single pass (SIMD when the CPU supports it),
+ * instead of a magnitude, an add and an argmax pass over memory.
+ * @param head First bins of the FFT (n)
+ * @param tail Last bins of the FFT (n)
+ * @param n Number of bins
+ * @param fold Folded magnitude (n), not written when NULL
+ * @param max Value of the peak
+ * @return Index of the peak
+ */
+FIRST_LORA_API uint32_t cpa_peak_32fc(const gr_complex *head,
+                                      const gr_complex *tail, uint32_t n,
+                                      float *fold, float *max);
+
+/**
+ * @brief Power of the best FPA rotation of one bin
+ * max over r in {1, j, -1, -j} of |a * r + b|^2, which expands to
+ * |a|^2 + |b|^2 + 2 * max(|Re(a * conj(b))|, |Im(a * conj(b))|)
+ * @param a Bin of the head of the spectrum
+ * @param b Matching bin of the tail of the spectrum
+ * @return Power of the best rotation
+ */
+inline float fpa_power_32fc(const gr_complex &a, const gr_complex &b) {
+  float pr = a.real() * b.real() + a.imag() * b.imag();
+  float pi = a.imag() * b.real() - a.real() * b.imag();
+  float cross = std::max(std::fabs(pr), std::fabs(pi));
+  return a.real() * a.real() + a.imag() * a.imag() + b.real() * b.real() +
+         b.imag() * b.imag() + 2 * cross;
+}
+
+/**
+ * @brief FPA peak search of a zero padded spectrum
+ * Evaluates the 4 phase rotations of every bin in a single pass (SIMD when
+ * the CPU supports it) and returns the first bin with the largest magnitude,
+ * as the previous search did with one fft_add() pass per rotation (see the
+ * benchmark).
+ * @param head First bins of the FFT (n)
+ * @param tail Last bins of the FFT (n)
+ * @param n Number of bins
+ * @param max Magnitude of the peak
+ * @return Index of the peak
+ */
+FIRST_LORA_API uint32_t fpa_peak_32fc(const gr_complex *head,
+                                      const gr_complex *tail, uint32_t n,
+                                      float *max);
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_DETECTOR_KERNELS_H */
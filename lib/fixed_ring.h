@@ -0,0 +1,116 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_FIXED_RING_H
+#define INCLUDED_FIRST_LORA_FIXED_RING_H
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Fixed capacity queue for the state of a single thread
+ *
+ * The slots live in the object, so pushing, popping and erasing never
+ * allocate. Elements are indexed from the oldest one. push_back() on a full
+ * ring refuses the element: the capacity must bound what the caller keeps.
+ * N must be a power of two.
+ */
+template <typename T, size_t N> class fixed_ring {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+private:
+  std::array<T, N> d_slots;
+  size_t d_head = 0; // Slot of the oldest element
+  size_t d_size = 0; // Elements queued
+
+public:
+  template <typename R, typename V> class iterator_base {
+  private:
+    R *d_ring;
+    size_t d_index;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = V *;
+    using reference = V &;
+
+    iterator_base(R *ring, size_t index) : d_ring(ring), d_index(index) {}
+    reference operator*() const { return (*d_ring)[d_index]; }
+    pointer operator->() const { return &(*d_ring)[d_index]; }
+    iterator_base &operator++() {
+      d_index++;
+      return *this;
+    }
+    bool operator==(const iterator_base &o) const {
+      return d_index == o.d_index;
+    }
+    bool operator!=(const iterator_base &o) const {
+      return d_index != o.d_index;
+    }
+  };
+  using iterator = iterator_base<fixed_ring, T>;
+  using const_iterator = iterator_base<const fixed_ring, const T>;
+
+  T &operator[](size_t i) { return d_slots[(d_head + i) % N]; }
+  const T &operator[](size_t i) const { return d_slots[(d_head + i) % N]; }
+  T &front() { return d_slots[d_head]; }
+  T &back() { return (*this)[d_size - 1]; }
+
+  /** @brief Append an element, false (and nothing done) if full */
+  bool push_back(const T &v) {
+    if (d_size == N) {
+      return false;
+    }
+    (*this)[d_size++] = v;
+    return true;
+  }
+
+  void pop_front() {
+    d_head = (d_head + 1) % N;
+    d_size--;
+  }
+
+  /** @brief Remove the elements matching pred, keeping the others in order */
+  template <typename P> void erase_if(P pred) {
+    size_t kept = 0;
+    for (size_t i = 0; i < d_size; i++) {
+      if (!pred((*this)[i])) {
+        if (kept != i) {
+          (*this)[kept] = (*this)[i];
+        }
+        kept++;
+      }
+    }
+    d_size = kept;
+  }
+
+  void clear() {
+    d_head = 0;
+    d_size = 0;
+  }
+
+  size_t size() const { return d_size; }
+  bool empty() const { return d_size == 0; }
+  bool full() const { return d_size == N; }
+  static constexpr size_t capacity() { return N; }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, d_size); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, d_size); }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_FIXED_RING_H */
@@ -6,6 +6,8 @@
  */
 
 #include "lora_detector_impl.h"
+#include "async_logger.h"
+#include "detector_kernels.h"
 
 #include <gnuradio/gr_complex.h>
 #include <gnuradio/io_signature.h>
@@ -21,359 +23,292 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <ctime>
-#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 
 namespace gr {
 namespace first_lora {
 
-#define DEMOD_HISTORY (8 + 5)
-
-int write_f_to_file(float *f, const char *filename, int n);
-
 using input_type = gr_complex;
 using output_type = gr_complex;
 lora_detector::sptr lora_detector::make(float threshold, uint8_t sf,
-                                        uint32_t bw, int method) {
-  return gnuradio::make_block_sptr<lora_detector_impl>(threshold, sf, bw,
-                                                       method);
+                                        uint32_t bw, int method, bool batch,
+                                        int padding, int output_mode,
+                                        uint32_t samp_rate, int max_peaks,
+                                        int hop, int nthreads,
+                                        bool low_latency, bool sc16) {
+  return gnuradio::make_block_sptr<lora_detector_impl>(
+      threshold, sf, bw, method, batch, padding, output_mode, samp_rate,
+      max_peaks, hop, nthreads, low_latency, sc16);
 }
 
 /*
  * The private constructor
  */
 lora_detector_impl::lora_detector_impl(float threshold, uint8_t sf, uint32_t bw,
-                                       int method)
+                                       int method, bool batch, int padding,
+                                       int output_mode, uint32_t samp_rate,
+                                       int max_peaks, int hop, int nthreads,
+                                       bool low_latency, bool sc16)
     : gr::block("lora_detector",
                 gr::io_signature::make(1 /* min inputs */, 1 /* max inputs */,
-                                       sizeof(input_type)),
+                                       sc16 ? sizeof(lv_16sc_t)
+                                            : sizeof(input_type)),
                 gr::io_signature::make(1 /* min outputs */, 1 /*max outputs */,
-                                       sizeof(output_type))),
-      d_threshold(threshold), d_sf(sf), d_bw(bw), d_method(method) {
+                                       sc16 ? sizeof(lv_16sc_t)
+                                            : sizeof(output_type))),
+      d_threshold(threshold), d_sf(sf), d_bw(bw), d_method(method),
+      d_batch(batch), d_padding(padding), d_output_mode(output_mode),
+      d_low_latency(low_latency), d_sc16(sc16),
+      d_itemsize(sc16 ? sizeof(lv_16sc_t) : sizeof(input_type)) {
   assert((d_sf > 5) && (d_sf < 13));
+  if (d_padding < 1) {
+    throw std::invalid_argument("lora_detector: padding must be at least 1");
+  }
+  if (d_output_mode < 0 || d_output_mode > 2) {
+    throw std::invalid_argument("lora_detector: output_mode must be 0, 1 or 2");
+  }
+  if (max_peaks < 1 || max_peaks > MAX_PEAKS) {
+    throw std::invalid_argument("lora_detector: max_peaks must be 1 to 8");
+  }
+  if (hop != 1 && hop != 2 && hop != 4 && hop != 8) {
+    throw std::invalid_argument("lora_detector: hop must be 1, 2, 4 or 8");
+  }
+  if (hop > 1 && max_peaks > 1) {
+    throw std::invalid_argument(
+        "lora_detector: hop and max_peaks cannot both be above 1");
+  }
+  if (nthreads < 0) {
+    throw std::invalid_argument("lora_detector: nthreads must be at least 0");
+  }
+  if (d_sc16 && d_method != 1 && d_method != 3) {
+    throw std::invalid_argument(
+        "lora_detector: sc16 input needs a sync method (1 or 3)");
+  }
+  if (d_low_latency && (d_output_mode == 0 || d_method == 2)) {
+    throw std::invalid_argument(
+        "lora_detector: low latency needs output_mode 1 or 2 and no debug "
+        "method");
+  }
 
   // Number of symbols
   d_sps = 1 << d_sf;
-  std::cout << "Symbols: " << d_sps << std::endl;
-  d_sn = 2 * d_sps;
-  std::cout << "Samples: " << d_sn << std::endl;
-
-  d_fs = d_bw * 2;
-  d_fft_size = 10 * d_sn;
-  d_bin_size = 10 * d_sps;
-  std::cout << "FFT size: " << d_fft_size << std::endl;
-  std::cout << "Bin size: " << d_bin_size << std::endl;
+  log_info("lora_detector", "Symbols: {}", d_sps);
+
+  // Without an input rate the input must be at 2x the bandwidth. With one,
+  // the sync methods run on the output of the resampler, at 1x.
+  d_fs = samp_rate ? samp_rate : d_bw * 2;
+  uint32_t sync_fs = d_fs;
+  if (samp_rate) {
+    if (d_method == 2) {
+      throw std::invalid_argument(
+          "lora_detector: the debug method needs samp_rate 0 (2x bandwidth)");
+    }
+    d_resampler = std::make_unique<polyphase_resampler>(d_fs, d_bw);
+    sync_fs = d_bw;
+    log_info("lora_detector", "Front end: {}/{} with {} taps per phase",
+             d_resampler->interpolation(), d_resampler->decimation(),
+             d_resampler->taps_per_phase());
+  }
+  // Samples per symbol at the input rate
+  d_sn = (uint32_t)std::llround((double)d_sps * d_fs / d_bw);
+  d_window = DEMOD_HISTORY * d_sn;
+  log_info("lora_detector", "Samples: {}", d_sn);
+
+  d_fft_size = d_padding * d_sps * (sync_fs / d_bw);
+  d_bin_size = d_padding * d_sps;
+  log_info("lora_detector", "FFT size: {}", d_fft_size);
+  log_info("lora_detector", "Bin size: {}", d_bin_size);
   d_cfo = 0;
   d_max_val = 0;
-  // FFT input vector
-  d_mult_hf_fft = std::vector<gr_complex>(d_fft_size);
-  d_fft_result = (lv_32fc_t *)malloc(d_fft_size * sizeof(lv_32fc_t));
-  if (d_fft_result == NULL) {
-    std::cerr << "Error: Failed to allocate memory for fft_result\n";
-    return;
-  }
-
-  // Reference downchip signal
-  d_ref_downchirp = g_downchirp(d_sf, d_bw, d_fs);
-  // Reference upchip signal
-  d_ref_upchirp = g_upchirp(d_sf, d_bw, d_fs);
 
-  d_dechirped.reserve(d_sn);
-
-  d_state = 0;
+  // Reference chirps, shared with every detector of the same SF
+  d_chirps = get_chirp_table(d_sf, d_bw, sync_fs);
 
-  message_port_register_out(pmt::mp("detected"));
-
-  set_history(DEMOD_HISTORY * d_sn);
-
-  // Set output buffer size to 8 + 5 * d_sn
-  set_output_multiple((8 + 5) * d_sn);
-}
-
-/*
- * Our virtual destructor.
- */
-lora_detector_impl::~lora_detector_impl() {
-  // Free memory
-  buffer.clear();
-  free(d_fft_result);
-
-  // Print the number of detected LoRa symbols
-  std::cout << "Detected LoRa symbols: " << detected_count << std::endl;
-  detected_count = 0;
-}
-
-void lora_detector_impl::forecast(int noutput_items,
-                                  gr_vector_int &ninput_items_required) {
-  /* <+forecast+> e.g. ninput_items_required[0] = noutput_items */
-  ninput_items_required[0] = noutput_items;
-}
-
-uint32_t lora_detector_impl::argmax_32f(const float *x, float *max,
-                                        uint16_t n) {
-  float mag = abs(x[0]);
-  float m = mag;
-  uint32_t index = 0;
-
-  for (int i = 0; i < n; i++) {
-    mag = abs(x[i]);
-    if (mag > m) {
-      m = mag;
-      index = i;
+  // Preamble/SFD state machine, with its own FFT plan and scratch buffers
+  d_sync = std::make_unique<sync_detector>(d_sf, d_bw, sync_fs, d_padding,
+                                           max_peaks, hop);
+  if (d_method == 3) {
+    d_sync->engine().set_peak_method(peak_method::FPA);
+  }
+  // Input kept in front of the windows for the window of a detection
+  d_lead = (uint32_t)std::ceil((double)d_sync->max_lag() * d_sn /
+                               d_sync->sn());
+
+  // Threads dechirping the windows of the preamble search ahead of the
+  // state machine, each with its own engine. Only batch mode steps through
+  // more than one window per call.
+  unsigned threads =
+      nthreads > 0 ? nthreads : std::thread::hardware_concurrency();
+  if (threads > 1 && d_batch && (d_method == 1 || d_method == 3) &&
+      max_peaks == 1) {
+    d_pool = std::make_unique<worker_pool>(threads);
+    for (unsigned i = 0; i < d_pool->size(); i++) {
+      d_search.push_back(d_sync->make_search_engine());
     }
+    d_ahead.resize(SEARCH_AHEAD * d_pool->size());
+    log_info("lora_detector", "Preamble search on {} threads", d_pool->size());
+  }
+  // Resample enough input at once for a batch of windows ahead
+  d_feed = d_sn;
+  if (d_pool) {
+    d_feed *= (d_ahead.size() + d_sync->hop() - 1) / d_sync->hop();
   }
 
-  *max = m;
-  return index;
-}
-
-uint32_t lora_detector_impl::get_fft_peak_abs(const lv_32fc_t *fft_r, float *b1,
-                                              float *b2, float *max) {
-  uint32_t peak = 0;
-  *max = 0;
-  // Compute the magnitude of the FFT in b1
-  volk_32fc_magnitude_32f(b1, fft_r, d_fft_size);
-  // Add the last part of the FFT to the first part.
-  // This is the CPA proposed in the paper to determine the phase misalignment
-  volk_32f_x2_add_32f(b2, b1, &b1[d_fft_size - d_bin_size], d_bin_size);
-  peak = argmax_32f(b2, max, d_bin_size);
-  return peak;
-}
+  d_dechirped.reserve(d_sn);
 
-uint32_t lora_detector_impl::get_fft_peak_phase(const lv_32fc_t *fft_r,
-                                                float *b1, float *b2,
-                                                gr_complex *buffer_c,
-                                                float *max) {
-  uint32_t tmp_max_idx = 0;
-  float tmp_max_val;
-  uint32_t peak = 0;
-  // This is the FPA proposed in the paper to determine the phase misalignment
-  for (int i = 0; i < 4; i++) {
-    float phase_offset = 2 * M_PI / 4 * i;
-    tmp_max_idx = fft_add(fft_r, b2, buffer_c, &tmp_max_val, phase_offset);
-    if (tmp_max_val > *max) {
-      *max = tmp_max_val;
-      peak = tmp_max_idx;
-    }
+  // Leading and trailing powers of the sliding window (method 4)
+  d_energy_scratch = (float *)volk_malloc(2 * ENERGY_CHUNK * sizeof(float),
+                                          volk_get_alignment());
+  if (d_energy_scratch == NULL) {
+    throw std::bad_alloc();
   }
-  return peak;
-}
 
-uint32_t lora_detector_impl::fft_add(const lv_32fc_t *fft_result, float *buffer,
-                                     gr_complex *buffer_c, float *max_val_p,
-                                     float phase_offset) {
-  lv_32fc_t s =
-      lv_cmake((float)std::cos(phase_offset), (float)std::sin(phase_offset));
-  volk_32fc_s32fc_multiply_32fc(buffer_c, fft_result, s, d_bin_size);
-  volk_32fc_x2_add_32fc(buffer_c, buffer_c,
-                        &fft_result[d_fft_size - d_bin_size], d_bin_size);
-  volk_32fc_magnitude_32f(buffer, buffer_c, d_bin_size);
-  return argmax_32f(buffer, max_val_p, d_bin_size);
-}
+  message_port_register_out(pmt::mp("detected"));
+  message_port_register_out(pmt::mp("stats"));
+  d_last_stats = std::chrono::steady_clock::now();
 
-int lora_detector_impl::compare_peak(const gr_complex *in, gr_complex *out) {
-  float max_amplitude = 0.0;
-  for (ulong i = 0; i < d_sn; i++) {
-    // Compute the amplitude of the received sample
-    float amplitude = std::abs(in[i]);
+  // Only the copy and the tags of a window need its samples: a message
+  // gives its position alone
+  d_keep_window = !(d_low_latency && d_output_mode == 2);
+  d_back = d_keep_window ? d_lead + (DEMOD_HISTORY - 1) * d_sn : 0;
 
-    if (amplitude > max_amplitude) {
-      max_amplitude = amplitude;
+  if (d_resampler) {
+    if (d_sc16) {
+      d_convert.resize(d_feed);
     }
+    // A window, a step and the last chunk fed
+    d_dec.reserve(2 * DEMOD_HISTORY * d_sync->sn() +
+                  (uint64_t)d_feed * d_sync->sn() / d_sn);
+    // Like the history of the block, zeros in front of the first symbol
+    d_dec.assign((DEMOD_HISTORY - 1) * d_sync->sn(), gr_complex(0, 0));
+    d_dec_start = -(int64_t)d_dec.size();
   }
-
-  if (max_amplitude < d_threshold) {
-    return 0;
+  if (!d_keep_window) {
+    // The symbol of a step, or of methods 0 and 4
+    set_history(d_sn);
+  } else if (d_resampler) {
+    // The state machine lags the resampler by up to a window, a step and
+    // the last chunk fed, plus the filter delay and the lag of a detection:
+    // keep that much input so the window of a detection can still be output
+    set_history(d_window + 3 * d_sn + d_lead +
+                (uint32_t)std::ceil(d_resampler->delay()) + 2);
   } else {
-    return 1;
-  }
-}
-
-int lora_detector_impl::write_chirp_to_file(
-    const std::vector<gr_complex> &chirp, const char *filename) {
-  std::cout << "Writing chirp to file\n";
-  FILE *file = fopen(filename, "w");
-  if (file == NULL) {
-    std::cerr << "Error: Failed to open file\n";
-    return -1;
+    set_history(d_back + d_sn);
   }
 
-  for (int j = 0; j < 5; j++) {
-    for (ulong i = 0; i < chirp.size(); i++) {
-      fprintf(file, "%f %f\n", chirp[i].real(), chirp[i].imag());
-    }
-    for (ulong i = 0; i < chirp.size(); i++) {
-      fprintf(file, "%f %f\n", 0.0, 0.0);
+  if (d_low_latency) {
+    // Run as soon as a step worth of input is in, whatever the output space
+    set_output_multiple(1);
+    if (d_keep_window) {
+      log_info("lora_detector",
+               "Low latency: the tags still need the whole window, history "
+               "stays at {} samples",
+               history());
     }
+  } else {
+    // Room for one window of 8 + 5 symbols
+    set_output_multiple(d_window);
   }
-
-  fclose(file);
-  std::cout << "Chirp written to file\n";
-  return 0;
+  log_info("lora_detector", "History: {}, output multiple: {}", history(),
+           output_multiple());
 }
 
-int write_symbol_to_file(const std::vector<gr_complex> &symbol,
-                         const char *filename) {
-  std::cout << "Writing symbol to file\n";
-  FILE *file = fopen(filename, "w");
-  if (file == NULL) {
-    std::cerr << "Error: Failed to open file\n";
-    return -1;
-  }
-
-  for (ulong i = 0; i < symbol.size(); i++) {
-    fprintf(file, "%f %f\n", symbol[i].real(), symbol[i].imag());
-  }
-
-  fclose(file);
-  std::cout << "Symbol written to file\n";
-  return 0;
+/*
+ * Our virtual destructor.
+ */
+lora_detector_impl::~lora_detector_impl() {
+  volk_free(d_energy_scratch);
+  // Print the number of detected LoRa symbols
+  log_info("lora_detector", "Detected LoRa symbols: {}", d_detections.load());
 }
 
-int write_fft_result_to_file(const lv_32fc_t *fft_result, const char *filename,
-                             int n) {
-  std::cout << "Writing fft result to file\n";
-  FILE *file = fopen(filename, "w");
-  if (file == NULL) {
-    std::cerr << "Error: Failed to open file\n";
-    return -1;
-  }
-
-  for (int i = 0; i < n; i++) {
-    fprintf(file, "%f %f\n", fft_result[i].real(), fft_result[i].imag());
-  }
-
-  fclose(file);
-  std::cout << "FFT result written to file\n";
-  return 0;
+std::map<std::string, uint64_t> lora_detector_impl::stats() {
+  sync_stats &s = d_sync->stats();
+  return {
+      {"calls", d_calls.load()},
+      {"samples", d_samples.load()},
+      {"detections", d_detections.load()},
+      {"latency_samples", d_latency.load()},
+      {"latency_samples_max", d_latency_max.load()},
+      {"symbols", s.symbols.load()},
+      {"ffts", s.ffts.load()},
+      {"preambles", s.preambles.load()},
+      {"sfd_found", s.sfd_found.load()},
+      {"sfd_failed", s.sfd_failed.load()},
+      {"time_ns_reset", s.state_ns[0].load()},
+      {"time_ns_preamble", s.state_ns[1].load()},
+      {"time_ns_sfd", s.state_ns[2].load()},
+      {"time_ns_output", s.state_ns[3].load()},
+  };
 }
 
-int write_f_to_file(float *f, const char *filename, int n) {
-  std::cout << "Writing f to file\n";
-  FILE *file = fopen(filename, "w");
-  if (file == NULL) {
-    std::cerr << "Error: Failed to open file\n";
-    return -1;
+std::vector<uint64_t> lora_detector_impl::peak_histogram() {
+  sync_stats &s = d_sync->stats();
+  std::vector<uint64_t> hist(s.peak_bins);
+  for (uint32_t i = 0; i < s.peak_bins; i++) {
+    hist[i] = s.peak_hist[i].load(std::memory_order_relaxed);
   }
+  return hist;
+}
 
-  for (int i = 0; i < n; i++) {
-    fprintf(file, "%f\n", f[i]);
-  }
+void lora_detector_impl::reset_stats() {
+  d_calls = 0;
+  d_samples = 0;
+  d_detections = 0;
+  d_latency = 0;
+  d_latency_max = 0;
+  d_sync->stats().reset();
+}
 
-  fclose(file);
-  std::cout << "f written to file\n";
-  return 0;
+void lora_detector_impl::set_stats_interval(double seconds) {
+  d_stats_interval = seconds;
 }
 
-std::pair<float, uint32_t> lora_detector_impl::dechirp(const gr_complex *in,
-                                                       bool is_up) {
-  gr_complex *blocks = (gr_complex *)volk_malloc(
-      d_fft_size * sizeof(gr_complex), volk_get_alignment());
-  if (blocks == NULL) {
-    std::cerr << "Error: Failed to allocate memory for up_blocks\n";
-    return std::make_pair(0, 0);
+void lora_detector_impl::publish_stats() {
+  double interval = d_stats_interval.load(std::memory_order_relaxed);
+  if (interval <= 0) {
+    return;
   }
-
-  // Dechirp https://dl.acm.org/doi/10.1145/3546869#d1e1181
-  volk_32fc_x2_multiply_32fc(
-      blocks, in, is_up ? &d_ref_downchirp[0] : &d_ref_upchirp[0], d_sn);
-
-  // Buffer for FFT
-  // lv_32fc_t *fft_r = (lv_32fc_t *)malloc(d_fft_size * sizeof(lv_32fc_t));
-  // if (fft_r == NULL) {
-  //   std::cerr << "Error: Failed to allocate memory for fft_r\n";
-  //   return std::make_pair(0, 0);
-  // }
-
-  // Copy dechirped signal to d_mult_hf_fft (zero padding)
-  memset(&d_mult_hf_fft[0], 0, d_fft_size * sizeof(gr_complex));
-  memcpy(&d_mult_hf_fft[0], blocks, d_sn * sizeof(gr_complex));
-
-  fft = fft_create_plan(d_fft_size, &d_mult_hf_fft[0], d_fft_result,
-                        LIQUID_FFT_FORWARD, 0);
-
-  // FFT
-  fft_execute(fft);
-
-  // Destroy FFT plan
-  fft_destroy_plan(fft);
-
-  // Free memory
-  volk_free(blocks);
-
-  // Get peak of FFT
-  float *b1 =
-      (float *)volk_malloc(d_fft_size * sizeof(float), volk_get_alignment());
-  float *b2 =
-      (float *)volk_malloc(d_bin_size * sizeof(float), volk_get_alignment());
-
-  if (b1 == NULL || b2 == NULL) {
-    std::cerr << "Error: Failed to allocate memory for b1 or b2\n";
-    return std::make_pair(0, 0);
+  auto now = std::chrono::steady_clock::now();
+  if (std::chrono::duration<double>(now - d_last_stats).count() < interval) {
+    return;
   }
-  float max;
-  uint32_t peak = get_fft_peak_abs(d_fft_result, b1, b2, &max);
+  d_last_stats = now;
 
-  // Free memory
-  // free(fft_r);
-  volk_free(b1);
-  volk_free(b2);
-
-  return std::make_pair(max, peak);
+  pmt::pmt_t msg = pmt::make_dict();
+  for (const auto &kv : stats()) {
+    msg = pmt::dict_add(msg, pmt::mp(kv.first), pmt::from_uint64(kv.second));
+  }
+  msg = pmt::dict_add(msg, pmt::mp("peak_histogram"),
+                      pmt::init_u64vector(d_sync->stats().peak_bins,
+                                          peak_histogram()));
+  message_port_pub(pmt::mp("stats"), msg);
 }
 
-int lora_detector_impl::detect_preamble(const gr_complex *in, gr_complex *out) {
-  int num_consumed = d_sn;
-  // Check if peak is above threshold
-  bool preamble_detected = false;
-  if (buffer.size() < MIN_PREAMBLE_CHIRPS) {
-    return num_consumed;
-  } else {
-    preamble_detected = true;
-  }
-
-  if (preamble_detected) {
-    std::cout << "Detected preamble\n";
-    d_state = 2;
-    // Move preamble peak to bin zero
-    num_consumed = d_sn - 2 * buffer[0] / 10;
-    // detected = true;
-    std::cout << "Buffer size: " << buffer.size() << std::endl;
-    for (ulong i = 0; i < buffer.size(); i++) {
-      std::cout << buffer[i] << std::endl;
-    }
+void lora_detector_impl::forecast(int noutput_items,
+                                  gr_vector_int &ninput_items_required) {
+  /* <+forecast+> e.g. ninput_items_required[0] = noutput_items */
+  ninput_items_required[0] = noutput_items;
+  if (d_low_latency) {
+    // A few output items are not worth a call without a step to run
+    ninput_items_required[0] =
+        std::max(noutput_items, (int)std::ceil(1.25 * d_sn));
   }
-
-  return num_consumed;
 }
 
-int lora_detector_impl::detect_sfd(const gr_complex *in, gr_complex *out,
-                                   const gr_complex *in0) {
-  int num_consumed = d_sn;
-  detected = false;
+int lora_detector_impl::compare_peak(const gr_complex *in, gr_complex *out) {
+  float max_amplitude = max_amplitude_32fc(in, d_sn);
 
-  if (d_sfd_recovery++ > 5) {
-    d_state = 0;
-    std::cout << "SFD recovery failed\n";
+  if (max_amplitude < d_threshold) {
     return 0;
+  } else {
+    return 1;
   }
-
-  auto [up_val, up_idx] = dechirp(in, true);
-  auto [down_val, down_idx] = dechirp(in, false);
-  // If absolute value of down_val is greater then we are in the sfd
-  if (abs(up_val) >= abs(down_val)) {
-    return num_consumed;
-  }
-
-  std::cout << "SFD detected\n";
-  std::cout << "Up: " << up_val << " Down: " << down_val << std::endl;
-
-  num_consumed = round(1.25 * d_sn);
-
-  // detected = true;
-  d_state = 3;
-  return num_consumed;
 }
 
 int lora_detector_impl::instantaneous_frequency(const gr_complex *in, int n) {
@@ -384,143 +319,312 @@ int lora_detector_impl::instantaneous_frequency(const gr_complex *in, int n) {
   return sum / n;
 }
 
-float realmod(float x, float y) {
-  float result = fmod(x, y);
-  return result >= 0 ? result : result + y;
-}
-
 int lora_detector_impl::general_work(int noutput_items,
                                      gr_vector_int &ninput_items,
                                      gr_vector_const_void_star &input_items,
                                      gr_vector_void_star &output_items) {
-  if (ninput_items[0] < (int)(DEMOD_HISTORY * d_sn))
+  const int window = d_window;
+  // Only the scheduler thread writes the counters
+  sync_stats::add(d_calls);
+  publish_stats();
+
+  if (ninput_items[0] < (int)history())
     return 0; // Not enough input
 
   auto in0 = static_cast<const input_type *>(input_items[0]);
-  auto in = &in0[d_sn * (DEMOD_HISTORY - 1)]; // Get the last lora symbol
+  auto in = &in0[history() - d_sn]; // Get the last lora symbol
+  // The same items as complex int16, with the sc16 input
+  auto in16 = static_cast<const lv_16sc_t *>(input_items[0]);
+  auto bytes = static_cast<const char *>(input_items[0]);
   auto out = static_cast<output_type *>(output_items[0]);
   uint32_t num_consumed = d_sn;
-
-  // Set the output to be the reference downchirp
-  // memcpy(out, &d_ref_downchirp[0], d_sn * sizeof(gr_complex));
-  // consume_each(d_sn);
-  // return noutput_items;
+  // Start of the current 13 symbols window (batch mode walks it forward)
+  int offset = 0;
+  // Input past the last sample that the decision of a detection read: it
+  // was already buffered, the detection came that much late
+  int lag = 0;
+  const int max_step = d_sync->max_step();
+  // Skip the window of a detection (the resampler has already consumed it)
+  bool skip_window = true;
+  // Where the state machine goes on after a detection, when the other
+  // candidate preambles are followed instead of skipping the window
+  int resume = 0;
+  // Most we can consume without eating into the history. When the samples
+  // are passed through, every consumed sample is also produced.
+  int max_consume = ninput_items[0] - history() + 1;
+  if (d_output_mode == 1) {
+    max_consume = std::min(max_consume, noutput_items);
+  }
 
   switch (d_method) {
-  case 1: {
-    // Dechirp
-    auto [up_val, up_idx] = dechirp(in, true);
-    d_max_val = up_val;
-    if (!buffer.empty()) {
-      float num = (float)up_idx - (float)buffer[0];
-      float distance = realmod(num, d_bin_size);
-      if (distance > (float)d_bin_size / 2) {
-        distance = d_bin_size - distance;
-      }
-      if (distance <= MAX_DISTANCE) {
-        buffer.insert(buffer.begin(), up_idx);
+  case 1:
+  case 3: {
+    if (d_resampler) {
+      int fed;
+      detected = run_sync_resampled(input_items[0], ninput_items[0],
+                                    max_consume, &offset, &fed, &lag);
+      num_consumed = fed;
+      skip_window = false;
+      break;
+    }
+    // Run the state machine on every complete symbol we have, stopping at a
+    // detection so its window is still in the input buffer. A step consumes
+    // at most 1.25 symbol (SFD) and must not eat into the history.
+    d_ahead_pos = d_ahead_count = 0;
+    while (offset + max_step <= max_consume) {
+      int windows = (max_consume - max_step - offset) / d_sync->search_step();
+      if (d_sc16) {
+        num_consumed = step_sync(&in16[d_back + offset], windows + 1);
       } else {
-        buffer.clear();
-        buffer.insert(buffer.begin(), up_idx);
+        num_consumed = step_sync(&in0[d_back + offset], windows + 1);
       }
-    } else {
-      buffer.insert(buffer.begin(), up_idx);
-    }
-    // std::cout << "\n--------------\nPeak: " << peak << " Max: " << max
-    //           << "\n--------------\n"
-    //           << std::endl;
-
-    switch (d_state) {
-    case 0: // Reset state
-      detected = false;
-      buffer.clear();
-      d_sfd_recovery = 0;
-      d_state = 1;
-      // std::cout << "State 0\n";
-      break;
-    case 1: // Preamble
-      // std::cout << "State 2\n";
-      num_consumed = detect_preamble(in, out);
-      if (num_consumed != d_sn) {
-        // Write the new buffer to a file
-        // write_f_to_file(b2,
-        //                 "/home/kazawai/dev/python/LoRa/LoRa/files/b2.txt",
-        //                 d_bin_size);
+      if ((detected = d_sync->detected())) {
+        resume = offset + num_consumed;
+        lag = ninput_items[0] - (d_back + offset + d_sn);
+        // Up to d_lead before the window stepped (multiple peaks). Before
+        // the input buffer when the window is not kept.
+        offset += d_back - d_sn * (DEMOD_HISTORY - 1) +
+                  (int)d_sync->detection_offset();
+        if (d_keep_window) {
+          // Further back when several SFDs ended together
+          offset = std::min(std::max(offset, 0), ninput_items[0] - window);
+        }
+        break;
+      }
+      offset += num_consumed;
+      if (!d_batch) {
+        break;
       }
-      d_max_val = up_val;
-      break;
-    case 2: // SFD
-      // std::cout << "State 3\n";
-      num_consumed = detect_sfd(in, out, in0);
-      break;
-    case 3: // Output signal
-      // std::cout << "State 4\n";
-      // num_consumed = noutput_items;
-      detected = true;
-      d_state = 0;
-      break;
     }
+    num_consumed = offset;
     break;
   }
   case 0: {
     detected = compare_peak(in, out);
-    num_consumed = noutput_items;
+    // The window ends with the symbol compared
+    offset = history() - window;
+    lag = ninput_items[0] - history();
+    num_consumed = std::min(noutput_items, max_consume);
     break;
   }
-  case 2: { // DEBUG
-    // Dechirp
-    gr_complex *blocks = (gr_complex *)volk_malloc(
-        d_fft_size * sizeof(gr_complex), volk_get_alignment());
-    if (blocks == NULL) {
-      std::cerr << "Error: Failed to allocate memory for up_blocks\n";
-      return -1;
+  case 4: {
+    // Energy of every one symbol window ending in the new samples, so no
+    // sample is skipped. Mean power threshold: |x|^2 >= threshold^2.
+    const int first = history() - 1;
+    int64_t end = energy_crossing_32fc(in0, first + max_consume, d_sn, first,
+                                       d_threshold * d_threshold * d_sn,
+                                       d_energy_scratch, 2 * ENERGY_CHUNK);
+    if ((detected = end >= 0)) {
+      // Output the window ending with the symbol that crossed the threshold
+      offset = end + 1 - window;
+      lag = ninput_items[0] - (end + 1);
+    } else {
+      num_consumed = max_consume;
     }
-
+    break;
+  }
+  case 2: { // DEBUG
     // Dechirp https://dl.acm.org/doi/10.1145/3546869#d1e1181
-    volk_32fc_x2_multiply_32fc(blocks, in, &d_ref_downchirp[0], d_sn);
-
-    // Return the dechirped signal
-    memcpy(out, blocks, d_sn * sizeof(gr_complex));
+    // and return the dechirped signal, straight into the output buffer
+    volk_32fc_x2_multiply_32fc(out, in, d_chirps->down, d_sn);
     num_consumed = d_sn;
+    sync_stats::add(d_samples, num_consumed);
     consume_each(num_consumed);
     return num_consumed;
 
     break;
   }
   default:
-    std::cerr << "Error: Invalid method\n";
+    log_error("lora_detector", "Invalid method {}", d_method);
     return -1;
   }
 
-  // Reset output buffer
-  memset(out, 0, noutput_items * sizeof(gr_complex));
-
   if (detected) {
-    std::cout << "Detected\n";
-    detected_count++;
-    // Signal should be centered around the peak of the preamble
-    // Copy the preamble to the output
-    memcpy(out, in0, (8 + 5) * d_sn * sizeof(gr_complex));
-    std::cout << "Copied to output" << std::endl;
-
-    // Send "detected" message
-    message_port_pub(pmt::mp("detected"), pmt::from_bool(true));
-
-    std::cout << "Sended message if connected" << std::endl;
-    consume_each(noutput_items);
-    std::cout << "Consumed noutput_items" << std::endl;
-    return (8 + 5) * d_sn;
-  } else {
-    // If no peak is detected, we do not want to output anything
-    consume_each(num_consumed);
-    return 0;
+    log_info("lora_detector", "Detected");
+    sync_stats::add(d_detections);
+    sync_stats::add(d_latency, lag);
+    if ((uint64_t)lag > d_latency_max.load(std::memory_order_relaxed)) {
+      d_latency_max.store(lag, std::memory_order_relaxed);
+    }
+    // Skip the detected packet, without consuming the history we must keep.
+    // A packet colliding with it may still be in its window: with several
+    // candidates, go on right after the detection.
+    if (skip_window && d_sync->max_peaks() > 1 &&
+        (d_method == 1 || d_method == 3)) {
+      num_consumed = std::min(resume, max_consume);
+    } else if (skip_window) {
+      // Small calls in low latency mode would not get past the packet
+      num_consumed = std::min(
+          offset + (d_low_latency ? window : noutput_items), max_consume);
+    }
+  }
+
+  int produced = 0;
+  switch (d_output_mode) {
+  case 0: // Window copy
+    if (detected) {
+      // Signal should be centered around the peak of the preamble
+      // Copy the preamble to the output
+      memcpy(out, &bytes[(size_t)offset * d_itemsize], window * d_itemsize);
+      produced = window;
+
+      // Send "detected" message
+      message_port_pub(d_pmt_detected, pmt::PMT_T);
+    }
+    break;
+  case 1: { // Tagged stream
+    // The output is the input delayed by the history, the window of a
+    // detection starts at out[offset]
+    memcpy(out, bytes, num_consumed * d_itemsize);
+    produced = num_consumed;
+    const uint64_t start = nitems_written(0) + offset;
+    if (detected) {
+      add_item_tag(0, start, pmt::mp("burst_start"), pmt::from_long(window),
+                   alias_pmt());
+      d_burst_ends.push_back(start + window - 1);
+      publish_detection(offset, window);
+    }
+    // End tags can fall after what this call produces
+    while (!d_burst_ends.empty() &&
+           d_burst_ends.front() < nitems_written(0) + produced) {
+      add_item_tag(0, d_burst_ends.front(), pmt::mp("burst_end"),
+                   pmt::from_long(window), alias_pmt());
+      d_burst_ends.pop_front();
+    }
+    break;
+  }
+  case 2: // Message only
+    if (detected) {
+      publish_detection(offset, window);
+    }
+    break;
+  }
+
+  sync_stats::add(d_samples, num_consumed);
+  consume_each(num_consumed);
+  return produced;
+}
+
+template <typename T>
+uint32_t lora_detector_impl::step_sync(const T *in, int windows) {
+  const dechirp_engine::spectrum_peak *ahead = nullptr;
+  if (d_pool && d_sync->searching()) {
+    const uint32_t hop = d_sync->search_step();
+    if (d_ahead_pos == d_ahead_count && windows > 1) {
+      // The windows until the next preamble only depend on their samples.
+      // The threads take every size()-th window, the FFTs cost the same.
+      const size_t n = std::min<size_t>(windows, d_ahead.size());
+      const size_t threads = d_search.size();
+      d_pool->parallel_for(threads, [&](size_t t) {
+        for (size_t k = t; k < n; k += threads) {
+          d_ahead[k] = d_sync->search_peak(*d_search[t], in + k * hop, k);
+        }
+      });
+      d_ahead_pos = 0;
+      d_ahead_count = n;
+    }
+    if (d_ahead_pos < d_ahead_count) {
+      ahead = &d_ahead[d_ahead_pos++];
+    }
+  }
+
+  uint32_t num_consumed = d_sync->step(in, ahead);
+  // A preamble found moves the windows: the rest is of no use
+  if (ahead == nullptr || !d_sync->searching() ||
+      num_consumed != d_sync->search_step()) {
+    d_ahead_pos = d_ahead_count = 0;
+  }
+  return num_consumed;
+}
+
+bool lora_detector_impl::run_sync_resampled(const void *in0, int ninput,
+                                            int feed, int *offset, int *fed,
+                                            int *lag) {
+  const int sn = d_sync->sn();
+  const int window = DEMOD_HISTORY * sn;
+  const int max_step = d_sync->max_step();
+  const int first_new = history() - 1;
+  bool found = false;
+
+  // Step through the resampled samples, resampling one more symbol of input
+  // whenever a step lacks samples. Stopping at a detection leaves the rest
+  // of the input to the next call, so the state machine never lags far
+  // behind the input buffer.
+  *fed = 0;
+  d_ahead_pos = d_ahead_count = 0;
+  while (true) {
+    int room = (int)d_dec.size() - (d_dec_offset + window - 1 + max_step);
+    if (room >= 0) {
+      uint32_t num_consumed =
+          step_sync(&d_dec[d_dec_offset + sn * (DEMOD_HISTORY - 1)],
+                    room / d_sync->search_step() + 1);
+      if ((found = d_sync->detected())) {
+        break;
+      }
+      d_dec_offset += num_consumed;
+      if (!d_batch) {
+        break;
+      }
+    } else if (*fed < feed) {
+      int n = std::min(feed - *fed, d_feed);
+      if (d_sc16) {
+        // The resampler works on floats: convert a chunk at a time
+        volk_16i_s32f_convert_32f(
+            (float *)d_convert.data(),
+            (const int16_t *)&((const lv_16sc_t *)in0)[first_new + *fed],
+            SC16_SCALE, 2 * n);
+        d_resampler->process(d_convert.data(), n, d_dec);
+      } else {
+        d_resampler->process(&((const gr_complex *)in0)[first_new + *fed], n,
+                             d_dec);
+      }
+      *fed += n;
+    } else {
+      break;
+    }
   }
 
-  // Set the output to be the reference downchirp
-  // memcpy(out, &d_ref_downchirp[0], noutput_items * sizeof(gr_complex));
+  if (found) {
+    // Resampled sample k stands for input sample k * M / L - delay
+    double start = (double)(d_dec_start + d_dec_offset +
+                            d_sync->detection_offset()) *
+                       d_resampler->decimation() /
+                       d_resampler->interpolation() -
+                   d_resampler->delay();
+    int64_t first = (int64_t)nitems_read(0) - (int64_t)(history() - 1);
+    *offset = (int)(std::llround(start) - first);
+    if (d_keep_window) {
+      *offset = std::min(std::max(*offset, 0), ninput - (int)d_window);
+    }
+    // Resampled past the symbol of the detection, and not resampled yet
+    *lag = (int)((int64_t)(d_dec.size() - d_dec_offset - window) *
+                     d_resampler->decimation() / d_resampler->interpolation() +
+                 (ninput - (int)history() + 1 - *fed));
+    // Skip the detected packet, or only the symbol of the detection when
+    // colliding packets are searched for
+    if (d_sync->max_peaks() > 1) {
+      d_dec_offset += d_sync->sn();
+    } else {
+      d_dec_offset = std::min(d_dec_offset + window, (int)d_dec.size());
+    }
+  }
+
+  // Drop what the state machine is done with
+  d_dec.erase(d_dec.begin(), d_dec.begin() + d_dec_offset);
+  d_dec_start += d_dec_offset;
+  d_dec_offset = 0;
+  return found;
+}
 
-  // Tell runtime system how many output items we produced.
-  // return noutput_items;
+void lora_detector_impl::publish_detection(int offset, int length) {
+  // Absolute position of the window in the input stream, in[offset] is
+  // history() - 1 samples before the first new sample of this call
+  int64_t start = (int64_t)nitems_read(0) + offset - (int64_t)(history() - 1);
+  pmt::pmt_t msg = pmt::make_dict();
+  msg = pmt::dict_add(msg, pmt::mp("detected"), pmt::PMT_T);
+  msg = pmt::dict_add(msg, pmt::mp("offset"), pmt::from_long(start));
+  msg = pmt::dict_add(msg, pmt::mp("length"), pmt::from_long(length));
+  message_port_pub(pmt::mp("detected"), msg);
 }
 
 } /* namespace first_lora */
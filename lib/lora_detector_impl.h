@@ -8,6 +8,11 @@
 #ifndef INCLUDED_FIRST_LORA_LORA_DETECTOR_IMPL_H
 #define INCLUDED_FIRST_LORA_LORA_DETECTOR_IMPL_H
 
+#include "chirp_cache.h"
+#include "polyphase_resampler.h"
+#include "sync_detector.h"
+#include "worker_pool.h"
+
 #include <gnuradio/expj.h>
 #include <gnuradio/first_lora/lora_detector.h>
 #include <gnuradio/gr_complex.h>
@@ -15,17 +20,21 @@
 #include <pmt/pmt.h>
 #include <volk/volk_complex.h>
 
+#include <atomic>
+#include <chrono>
 #include <complex>
 #include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
-#define MIN_PREAMBLE_CHIRPS 6
-#define MAX_DISTANCE 10
-
 namespace gr {
 namespace first_lora {
 
-static int detected_count = 0; // Number of detected LoRa symbols
+#define ENERGY_CHUNK 4096 // Samples per power chunk of the energy detector
+#define SEARCH_AHEAD 4    // Search windows computed at once per thread
 
 static const pmt::pmt_t d_pmt_detected = pmt::intern("detected");
 
@@ -34,162 +43,103 @@ private:
   float d_threshold;                   // Threshold for detecting LoRa signal
   uint8_t d_sf;                        // Spreading factor
   uint32_t d_bw;                       // Bandwidth
-  uint32_t d_fs;                       // Sampling rate
+  uint32_t d_fs;                       // Input sampling rate
   int d_method;                        // Method used
+  bool d_batch;                        // Process every symbol of a call
+  int d_padding;                       // FFT zero-padding factor
+  int d_output_mode;                   // Window copy, tagged stream, message
+  bool d_low_latency;                  // Output multiple 1, least history
+  bool d_sc16;                         // Complex int16 items in and out
+  size_t d_itemsize;                   // Size of an input and output item
+  bool d_keep_window;                  // Window of a detection kept in input
+  uint32_t d_back;                     // Input before the symbol of a step
   int d_prev_detected = 0;             // Previous detected LoRa symbols
   uint32_t d_sps;                      // Samples per symbol (2^sf)
-  uint32_t d_sn;                       // Number of samples
+  uint32_t d_sn;                       // Samples per symbol at d_fs
+  uint32_t d_window;                   // DEMOD_HISTORY symbols at d_fs
+  uint32_t d_lead;                     // Input before the window of a step
   float d_cfo;                         // Carrier frequency offset
   float d_max_val;                     // Maximum value of the FFT
-  std::vector<uint32_t> buffer;        // Buffer for LoRa symbol
   std::vector<gr_complex> d_dechirped; // Dechirped samples
-  std::vector<gr_complex> d_ref_downchirp; // Downchirp reference signal
-  std::vector<gr_complex> d_ref_upchirp;   // Upchirp reference signal
+  std::shared_ptr<const chirp_table> d_chirps; // Reference chirps
   uint32_t d_fft_size;                     // FFT size
-  uint32_t d_bin_size;                     // Bin size (d_fft_size / 2)
-  fftplan fft;                             // FFT plan
-  std::vector<gr_complex> d_mult_hf_fft;   // FFT result
-  int d_sfd_recovery = 0;                  // SFD recovery count
+  uint32_t d_bin_size;                     // Bin size (d_padding * d_sps)
+  std::unique_ptr<sync_detector> d_sync;   // Preamble/SFD state machine
+  std::unique_ptr<polyphase_resampler> d_resampler; // Front end to 1x, if any
+  std::vector<gr_complex> d_dec;           // Resampled samples still needed
+  int64_t d_dec_start = 0;                 // Resampled index of d_dec[0]
+  int d_dec_offset = 0;                    // Window start of d_sync in d_dec
+  int d_feed;                              // Input samples resampled at once
+  std::vector<gr_complex> d_convert;       // sc16 input for the resampler
+  std::unique_ptr<worker_pool> d_pool;     // Computes search windows ahead
+  std::vector<std::unique_ptr<dechirp_engine>> d_search; // One per thread
+  std::vector<dechirp_engine::spectrum_peak> d_ahead; // Peaks computed ahead
+  size_t d_ahead_pos = 0;                  // Next peak of d_ahead to use
+  size_t d_ahead_count = 0;                // Peaks of d_ahead computed
+  float *d_energy_scratch;                 // Powers of the energy detector
+  std::deque<uint64_t> d_burst_ends;       // burst_end tags not yet produced
+  std::atomic<uint64_t> d_calls{0};        // general_work calls
+  std::atomic<uint64_t> d_samples{0};      // Input samples consumed
+  std::atomic<uint64_t> d_detections{0};   // Detections output
+  std::atomic<uint64_t> d_latency{0};      // Input past the detections
+  std::atomic<uint64_t> d_latency_max{0};  // Most input past a detection
+  std::atomic<double> d_stats_interval{1}; // Period of the stats message (s)
+  std::chrono::steady_clock::time_point d_last_stats; // Last stats message
   bool detected = false;                   // Detected LoRa signal
-  int d_state = 0;                         // State of the detector
-  lv_32fc_t *d_fft_result;                 // FFT result
-  /**
-   * @brief Generate chirp signal
-   * chirp(t;f_0) = A(t)exp(j2π(f_0 + (B/2T)t)t) (where A(t) is the amplitude
-   * envelope, f_0 is the initial frequency, B is the bandwidth, and T is the
-   * chirp period)
-   * @param sf Spreading factor
-   * @param bw Bandwidth
-   * @param fs Sampling rate
-   * @param upchirp Upchirp or downchirp
-   * @return Chirp signal
-   */
-  std::vector<gr_complex> g_chirp(uint8_t sf, uint32_t bw, uint32_t fs,
-                                  bool upchirp) {
-    std::vector<gr_complex> chirp;
-    uint32_t n = (1 << sf) * 2;
-    double T = n / (double)fs;
-    for (ulong i = 0; i < n; i++) {
-      double t = i / (double)fs;
-      double phase = 2 * M_PI * (bw / (2 * T) * t * t);
-      if (!upchirp) {
-        phase = -phase;
-      }
-      chirp.push_back(gr_complex(std::cos(phase), std::sin(phase)));
-    }
-    return chirp;
-  }
 
-  /**
-   * @brief Generate chirp signal (equivalent method to the traditional one)
-   * @see g_chirp
-   */
-  std::vector<gr_complex> g_chirp2(uint8_t sf, uint32_t bw, uint32_t fs,
-                                   bool upchirp) {
-    std::vector<gr_complex> chirp;
-    uint32_t n = (1 << sf) * 2;
-    int fsr = (int)fs / bw;
-    for (ulong i = 0; i < n; i++) {
-      double phase = M_PI / fsr * (i - i * i / (float)n);
-      chirp.push_back(gr_complex(std::polar(1.0, upchirp ? -phase : phase)));
-    }
-    return chirp;
-  }
-
-  std::vector<gr_complex> g_chirp3(uint8_t sf, uint32_t bw, uint32_t fs,
-                                   bool upchirp) {
-    std::vector<gr_complex> chirp;
-    uint32_t n = (1 << sf) * 2;
-    for (ulong i = 0; i < n; i++) {
-      chirp.push_back(gr_complex(1.0, 1.0) *
-                      gr_expj(2.0 * M_PI * 1 / fs * i *
-                              (bw / 2.0 * (-0.5 * bw * n / 2) * 1 / fs * i) *
-                              (upchirp ? 1 : -1.0f)));
-    }
-    return chirp;
-  }
-  /**
-   * @brief Generate downchirp signal
-   * @param sf Spreading factor
-   * @param bw Bandwidth
-   * @param fs Sampling rate
-   * @return Downchirp signal
-   */
-  std::vector<gr_complex> g_downchirp(uint8_t sf, uint32_t bw, uint32_t fs) {
-    return g_chirp2(sf, bw, fs, false);
-  }
-  /**
-   * @brief Generate upchirp signal
-   * @param sf Spreading factor
-   * @param bw Bandwidth
-   * @param fs Sampling rate
-   * @return Upchirp signal
-   */
-  std::vector<gr_complex> g_upchirp(uint8_t sf, uint32_t bw, uint32_t fs) {
-    return g_chirp2(sf, bw, fs, true);
-  }
+  int compare_peak(const gr_complex *in, gr_complex *out);
+
+  int instantaneous_frequency(const gr_complex *in, int n);
 
-  int write_chirp_to_file(const std::vector<gr_complex> &chirp,
-                          const char *filename);
+  void on_detected_message(pmt::pmt_t msg);
 
   /**
-   * @brief Get peak of FFT using ABS comparaison
-   * @param fft_r FFT result
-   * @param b1 Buffer 1 (real)
-   * @param b2 Buffer 2 (imag)
-   * @param buffer_c Buffer complex
-   * @return Peak of FFT
+   * @brief One step of the state machine, with the windows of the preamble
+   * search computed ahead on the pool when there is one
+   * @param in Symbol of the window, as passed to sync_detector::step()
+   * @param windows Windows of the preamble search the input holds from
+   *                this one on (this one included)
+   * @return Number of samples to consume
    */
-  uint32_t get_fft_peak_abs(const lv_32fc_t *fft_r, float *b1, float *b2,
-                            float *max);
+  template <typename T> uint32_t step_sync(const T *in, int windows);
 
   /**
-   * @brief Get peak of FFT using its phase
-   * @param fft_r FFT result
-   * @param b1 Buffer 1 (real)
-   * @param b2 Buffer 2 (imag)
-   * @param buffer_c Buffer complex
-   * @return Peak of FFT
+   * @brief Sync methods behind the resampler
+   * @param in0 Start of the input buffer (gr_complex or sc16 items)
+   * @param ninput Number of input items
+   * @param feed Most new input samples to resample
+   * @param offset Set to the start of the detected window in in0
+   * @param fed Set to the number of input samples resampled (consumed)
+   * @param lag Set to the input samples past the symbol of the detection
+   * @return Whether a packet was detected
    */
-  uint32_t get_fft_peak_phase(const lv_32fc_t *fft_r, float *b1, float *b2,
-                              gr_complex *buffer_c, float *max);
+  bool run_sync_resampled(const void *in0, int ninput, int feed,
+                          int *offset, int *fed, int *lag);
 
   /**
-   * @brief Add FFT to phase offset
-   * @param fft_result FFT result
-   * @param buffer Buffer 1
-   * @param buffer_c Buffer complex
-   * @param max_val_p the maximum value of the new FFT
-   * @param phase_offset The phase offset
+   * @brief Publish a detection with its position in the input stream
+   * @param offset Start of the window in the input buffer of this call
+   * @param length Length of the window
    */
-  uint32_t fft_add(const lv_32fc_t *fft_result, float *buffer,
-                   gr_complex *buffer_c, float *max_val_p, float phase_offset);
+  void publish_detection(int offset, int length);
 
   /**
-   * @brief Get maximum value of array
-   * @param x Array
-   * @param max Maximum value
-   * @param n Length of array
-   * @return Maximum value
+   * @brief Publish stats() on the "stats" port if the interval has elapsed
    */
-  uint32_t argmax_32f(const float *x, float *max, uint16_t n);
-
-  int compare_peak(const gr_complex *in, gr_complex *out);
-
-  std::pair<float, uint32_t> dechirp(const gr_complex *in, bool is_up);
-
-  int instantaneous_frequency(const gr_complex *in, int n);
-
-  int detect_preamble(const gr_complex *in, gr_complex *out);
-
-  int detect_sfd(const gr_complex *in, gr_complex *out, const gr_complex *in0);
-
-  void on_detected_message(pmt::pmt_t msg);
+  void publish_stats();
 
 public:
-  lora_detector_impl(float threshold, uint8_t sf, uint32_t bw, int method);
+  lora_detector_impl(float threshold, uint8_t sf, uint32_t bw, int method,
+                     bool batch, int padding, int output_mode,
+                     uint32_t samp_rate, int max_peaks, int hop,
+                     int nthreads, bool low_latency, bool sc16);
   ~lora_detector_impl();
 
+  std::map<std::string, uint64_t> stats();
+  std::vector<uint64_t> peak_histogram();
+  void reset_stats();
+  void set_stats_interval(double seconds);
+
   // Where all the action really happens
   void forecast(int noutput_items, gr_vector_int &ninput_items_required);
 
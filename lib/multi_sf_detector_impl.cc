@@ -0,0 +1,153 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "multi_sf_detector_impl.h"
+#include "async_logger.h"
+
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace gr {
+namespace first_lora {
+
+using input_type = gr_complex;
+using output_type = gr_complex;
+multi_sf_detector::sptr multi_sf_detector::make(uint8_t sf_min, uint8_t sf_max,
+                                                uint32_t bw, int nthreads) {
+  return gnuradio::make_block_sptr<multi_sf_detector_impl>(sf_min, sf_max, bw,
+                                                           nthreads);
+}
+
+static unsigned pool_size(int nthreads, unsigned nlanes) {
+  unsigned n = nthreads > 0 ? nthreads : std::thread::hardware_concurrency();
+  return std::max(1u, std::min(n, nlanes));
+}
+
+/*
+ * The private constructor
+ */
+multi_sf_detector_impl::multi_sf_detector_impl(uint8_t sf_min, uint8_t sf_max,
+                                               uint32_t bw, int nthreads)
+    : gr::block("multi_sf_detector",
+                gr::io_signature::make(1 /* min inputs */, 1 /* max inputs */,
+                                       sizeof(input_type)),
+                gr::io_signature::make(1 /* min outputs */, 1 /*max outputs */,
+                                       sizeof(output_type))),
+      d_bw(bw), d_lanes(sf_max >= sf_min ? sf_max - sf_min + 1 : 0),
+      d_pool(pool_size(nthreads, d_lanes.size())) {
+  if (sf_min < 6 || sf_max > 12 || sf_min > sf_max) {
+    throw std::invalid_argument(
+        "multi_sf_detector: SF range must be within [6, 12]");
+  }
+
+  d_fs = d_bw * 2;
+  for (uint8_t sf = sf_min; sf <= sf_max; sf++) {
+    d_lanes[sf - sf_min].sync = std::make_unique<sync_detector>(sf, d_bw, d_fs);
+  }
+  d_sn_max = d_lanes.back().sync->sn();
+  d_window = DEMOD_HISTORY * d_sn_max;
+
+  log_info("multi_sf_detector", "SF {}-{} on {} threads", (int)sf_min,
+           (int)sf_max, d_pool.size());
+
+  message_port_register_out(pmt::mp("detected"));
+
+  // Every SF shares the history of the largest one, and its output has room
+  // for the window of the largest one
+  set_history(d_window);
+  set_output_multiple(d_window);
+}
+
+/*
+ * Our virtual destructor.
+ */
+multi_sf_detector_impl::~multi_sf_detector_impl() {}
+
+void multi_sf_detector_impl::forecast(int noutput_items,
+                                      gr_vector_int &ninput_items_required) {
+  ninput_items_required[0] = noutput_items;
+}
+
+void multi_sf_detector_impl::run_lane(sf_lane &lane, const gr_complex *in0,
+                                      int ninput) {
+  const int sn = lane.sync->sn();
+  const int max_step = lane.sync->max_step();
+  // The current symbol of a lane ends where its window ends, d_window after
+  // the lane offset, so a step must leave the history of the largest SF
+  while (!lane.pending &&
+         lane.offset + (int)d_window - 1 + max_step <= ninput) {
+    uint32_t num_consumed = lane.sync->step(&in0[lane.offset + d_window - sn]);
+    if (lane.sync->detected()) {
+      lane.pending = true;
+      break;
+    }
+    lane.offset += num_consumed;
+  }
+}
+
+int multi_sf_detector_impl::general_work(int noutput_items,
+                                         gr_vector_int &ninput_items,
+                                         gr_vector_const_void_star &input_items,
+                                         gr_vector_void_star &output_items) {
+  if (ninput_items[0] < (int)d_window)
+    return 0; // Not enough input
+
+  auto in0 = static_cast<const input_type *>(input_items[0]);
+  auto out = static_cast<output_type *>(output_items[0]);
+  const int ninput = ninput_items[0];
+
+  d_pool.parallel_for(d_lanes.size(),
+                      [&](size_t k) { run_lane(d_lanes[k], in0, ninput); });
+
+  // Output the detection that ends first, the others wait for the next call
+  sf_lane *hit = nullptr;
+  for (auto &lane : d_lanes) {
+    if (lane.pending && (hit == nullptr || lane.offset < hit->offset)) {
+      hit = &lane;
+    }
+  }
+
+  int produced = 0;
+  if (hit != nullptr) {
+    // The window of the SF detected, which ends with the symbol of its lane
+    const int window = DEMOD_HISTORY * hit->sync->sn();
+    memcpy(out, &in0[hit->offset + d_window - window],
+           window * sizeof(gr_complex));
+
+    pmt::pmt_t msg = pmt::make_dict();
+    msg = pmt::dict_add(msg, pmt::mp("detected"), pmt::PMT_T);
+    msg = pmt::dict_add(msg, pmt::mp("sf"), pmt::from_long(hit->sync->sf()));
+    msg = pmt::dict_add(msg, pmt::mp("length"), pmt::from_long(window));
+    message_port_pub(pmt::mp("detected"), msg);
+
+    log_info("multi_sf_detector", "Detected SF{}", (int)hit->sync->sf());
+    hit->pending = false;
+    // Skip the detected packet, as lora_detector does
+    hit->offset += window;
+    produced = window;
+  }
+
+  // Consume what every lane is done with
+  int consumed = ninput - (int)d_window + 1;
+  for (auto &lane : d_lanes) {
+    consumed = std::min(consumed, lane.offset);
+  }
+  for (auto &lane : d_lanes) {
+    lane.offset -= consumed;
+  }
+  consume_each(consumed);
+
+  return produced;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
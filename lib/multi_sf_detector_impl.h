@@ -0,0 +1,66 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_IMPL_H
+#define INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_IMPL_H
+
+#include "sync_detector.h"
+#include "worker_pool.h"
+
+#include <gnuradio/first_lora/multi_sf_detector.h>
+#include <gnuradio/gr_complex.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+class multi_sf_detector_impl : public multi_sf_detector {
+private:
+  /**
+   * @brief One spreading factor walking the shared input
+   */
+  struct sf_lane {
+    std::unique_ptr<sync_detector> sync; // Preamble/SFD state machine
+    int offset = 0;       // Start of the lane in the input of this call
+    bool pending = false; // Detection waiting to be output
+  };
+
+  uint32_t d_bw;                // Bandwidth
+  uint32_t d_fs;                // Sampling rate
+  uint32_t d_sn_max;            // Samples per symbol of the largest SF
+  uint32_t d_window;            // DEMOD_HISTORY symbols of the largest SF
+  std::vector<sf_lane> d_lanes; // One lane per SF
+  worker_pool d_pool;           // Runs the lanes in parallel
+
+  /**
+   * @brief Walk one lane over the input until it detects or runs out
+   * @param lane Lane to run
+   * @param in0 Start of the input buffer
+   * @param ninput Number of input items
+   */
+  void run_lane(sf_lane &lane, const gr_complex *in0, int ninput);
+
+public:
+  multi_sf_detector_impl(uint8_t sf_min, uint8_t sf_max, uint32_t bw,
+                         int nthreads);
+  ~multi_sf_detector_impl();
+
+  // Where all the action really happens
+  void forecast(int noutput_items, gr_vector_int &ninput_items_required);
+
+  int general_work(int noutput_items, gr_vector_int &ninput_items,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items);
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_MULTI_SF_DETECTOR_IMPL_H */
@@ -6,6 +6,7 @@
  */
 
 #include "mysquare_impl.h"
+#include "async_logger.h"
 
 #include <gnuradio/gr_complex.h>
 #include <gnuradio/io_signature.h>
@@ -47,8 +48,10 @@ int mysquare_impl::general_work(int noutput_items, gr_vector_int& ninput_items,
   auto in = static_cast<const input_type*>(input_items[0]);
   auto out = static_cast<output_type*>(output_items[0]);
 
-  for (int i = 0; i < noutput_items; i++) {
-    std::cout << in[i] << std::endl;
+  if (async_logger::instance().enabled(log_level::debug)) {
+    for (int i = 0; i < noutput_items; i++) {
+      log_debug("mysquare", "{}", in[i]);
+    }
   }
   // Do <+signal processing+>
   // Tell runtime system how many input items we consumed on
@@ -0,0 +1,102 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pfb_channelizer.h"
+#include "polyphase_resampler.h"
+
+#include <volk/volk.h>
+#include <volk/volk_malloc.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+pfb_channelizer::pfb_channelizer(uint32_t nchannels)
+    : d_nchannels(nchannels), d_ntaps(PFB_TAPS_PER_CHANNEL) {
+  if (d_nchannels < 1) {
+    throw std::invalid_argument("pfb_channelizer: at least one channel");
+  }
+
+  // Prototype cut at half the channel spacing. Branch r holds the taps
+  // r, r + N, r + 2N, ... reversed, the oldest input first.
+  const uint32_t n = d_ntaps * d_nchannels;
+  std::vector<float> proto = kaiser_lowpass(n, 0.5 / d_nchannels);
+  d_taps.resize(n);
+  for (uint32_t r = 0; r < d_nchannels; r++) {
+    for (uint32_t q = 0; q < d_ntaps; q++) {
+      d_taps[r * d_ntaps + q] = proto[(d_ntaps - 1 - q) * d_nchannels + r];
+    }
+  }
+
+  d_fft_in = (lv_32fc_t *)volk_malloc(d_nchannels * sizeof(lv_32fc_t),
+                                      volk_get_alignment());
+  d_fft_out = (lv_32fc_t *)volk_malloc(d_nchannels * sizeof(lv_32fc_t),
+                                       volk_get_alignment());
+  if (d_fft_in == NULL || d_fft_out == NULL) {
+    volk_free(d_fft_in);
+    volk_free(d_fft_out);
+    throw std::bad_alloc();
+  }
+  d_plan = fft_create_plan(d_nchannels, d_fft_in, d_fft_out,
+                           LIQUID_FFT_BACKWARD, 0);
+
+  // Same layout as polyphase_resampler: P - 1 blocks of delay line, then
+  // room for the first P - 1 blocks of the next input
+  d_edge.assign(2 * (d_ntaps - 1) * d_nchannels, gr_complex(0, 0));
+}
+
+pfb_channelizer::~pfb_channelizer() {
+  fft_destroy_plan(d_plan);
+  volk_free(d_fft_in);
+  volk_free(d_fft_out);
+}
+
+void pfb_channelizer::filter_block(const gr_complex *x, gr_complex *y) {
+  const uint32_t n = d_nchannels;
+  // Branch r sees every N-th sample, ending N - 1 - r samples before the
+  // newest input of the block
+  for (uint32_t r = 0; r < n; r++) {
+    const float *t = &d_taps[r * d_ntaps];
+    const gr_complex *xr = &x[n - 1 - r];
+    gr_complex acc(0, 0);
+    for (uint32_t q = 0; q < d_ntaps; q++) {
+      acc += t[q] * xr[q * n];
+    }
+    d_fft_in[r] = acc;
+  }
+  // Channel k is the branch outputs rotated by exp(2j pi k r / N)
+  fft_execute(d_plan);
+  memcpy(y, d_fft_out, n * sizeof(gr_complex));
+}
+
+void pfb_channelizer::process(const gr_complex *in, size_t nblocks,
+                              gr_complex *out) {
+  const size_t h = (size_t)(d_ntaps - 1) * d_nchannels;
+  const size_t n = nblocks * d_nchannels;
+
+  // Block j needs the P blocks ending with it. The first ones straddle the
+  // delay line and the input and are read from d_edge.
+  memcpy(&d_edge[h], in, std::min(n, h) * sizeof(gr_complex));
+  for (size_t j = 0; j < nblocks; j++) {
+    size_t start = j * d_nchannels;
+    const gr_complex *x = start >= h ? &in[start - h] : &d_edge[start];
+    filter_block(x, &out[j * d_nchannels]);
+  }
+
+  if (n >= h) {
+    memcpy(d_edge.data(), &in[n - h], h * sizeof(gr_complex));
+  } else {
+    memmove(d_edge.data(), &d_edge[n], h * sizeof(gr_complex));
+  }
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
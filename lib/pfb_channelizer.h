@@ -0,0 +1,75 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_PFB_CHANNELIZER_H
+#define INCLUDED_FIRST_LORA_PFB_CHANNELIZER_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+#include <liquid/liquid.h>
+#include <volk/volk_complex.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define PFB_TAPS_PER_CHANNEL 16 // Prototype taps per polyphase branch
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Critically sampled polyphase filterbank analyser
+ *
+ * Splits the input into N channels spaced by fs / N, each decimated by N:
+ * every block of N input samples gives one sample of every channel. Channel
+ * k is centred on k * fs / N (k - N for the upper half, negative
+ * frequencies). A block costs N * PFB_TAPS_PER_CHANNEL multiply-adds and
+ * one N-point FFT, whatever the number of channels used afterwards.
+ */
+class FIRST_LORA_API pfb_channelizer {
+private:
+  uint32_t d_nchannels;             // N
+  uint32_t d_ntaps;                 // Taps per branch (P)
+  std::vector<float> d_taps;        // N branches of P reversed taps
+  std::vector<gr_complex> d_edge;   // Delay line followed by the next inputs
+  lv_32fc_t *d_fft_in;              // Branch outputs (aligned)
+  lv_32fc_t *d_fft_out;             // Channel samples of a block (aligned)
+  fftplan d_plan;                   // N-point inverse FFT
+
+  void filter_block(const gr_complex *x, gr_complex *y);
+
+public:
+  /**
+   * @param nchannels Number of channels (N)
+   */
+  explicit pfb_channelizer(uint32_t nchannels);
+  ~pfb_channelizer();
+
+  pfb_channelizer(const pfb_channelizer &) = delete;
+  pfb_channelizer &operator=(const pfb_channelizer &) = delete;
+
+  /**
+   * @brief Channelise nblocks blocks of N input samples
+   * @param in nblocks * N input samples
+   * @param nblocks Number of blocks
+   * @param out nblocks * N channel samples, block major (out[j * N + k] is
+   *            sample j of channel k)
+   */
+  void process(const gr_complex *in, size_t nblocks, gr_complex *out);
+
+  /** @brief Group delay of the prototype filter in input samples */
+  double delay() const { return (d_ntaps * d_nchannels - 1) / 2.0; }
+
+  uint32_t nchannels() const { return d_nchannels; }
+  uint32_t taps_per_channel() const { return d_ntaps; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_PFB_CHANNELIZER_H */
@@ -0,0 +1,124 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "polyphase_resampler.h"
+
+#include <volk/volk.h>
+#include <volk/volk_malloc.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+#define KAISER_BETA 7.0 // About 70 dB of stopband rejection
+
+/**
+ * @brief Zeroth order modified Bessel function of the first kind
+ */
+static double bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+std::vector<float> kaiser_lowpass(uint32_t ntaps, double cutoff) {
+  std::vector<double> proto(ntaps);
+  double sum = 0;
+  for (uint32_t i = 0; i < ntaps; i++) {
+    double t = i - (ntaps - 1) / 2.0;
+    double x = ntaps > 1 ? 2 * t / (ntaps - 1) : 0;
+    double sinc =
+        t == 0 ? 1 : std::sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+    proto[i] =
+        sinc * bessel_i0(KAISER_BETA * std::sqrt(std::max(0.0, 1 - x * x)));
+    sum += proto[i];
+  }
+  std::vector<float> taps(ntaps);
+  for (uint32_t i = 0; i < ntaps; i++) {
+    taps[i] = proto[i] / sum;
+  }
+  return taps;
+}
+
+polyphase_resampler::polyphase_resampler(uint32_t in_rate, uint32_t out_rate) {
+  if (in_rate == 0 || out_rate == 0) {
+    throw std::invalid_argument("polyphase_resampler: rates must be positive");
+  }
+  uint32_t g = std::gcd(in_rate, out_rate);
+  d_interp = out_rate / g;
+  d_decim = in_rate / g;
+
+  // Prototype at L times the input rate, cut at the narrower of the two
+  // Nyquist bands so neither aliases nor images pass
+  const uint32_t ratio = std::max(d_interp, d_decim);
+  d_ntaps = (2 * RESAMPLER_HALF_TAPS * ratio + d_interp - 1) / d_interp;
+  const uint32_t n = d_ntaps * d_interp;
+  std::vector<float> proto = kaiser_lowpass(n, 0.5 / ratio);
+
+  // Phase p uses the prototype taps p, p + L, p + 2L, ... Each phase is stored
+  // reversed so an output is a plain dot product with the oldest input first.
+  d_taps = (float *)volk_malloc(n * sizeof(float), volk_get_alignment());
+  if (d_taps == NULL) {
+    throw std::bad_alloc();
+  }
+  for (uint32_t p = 0; p < d_interp; p++) {
+    for (uint32_t k = 0; k < d_ntaps; k++) {
+      d_taps[p * d_ntaps + k] =
+          proto[(d_ntaps - 1 - k) * d_interp + p] * d_interp;
+    }
+  }
+
+  // The input is seen as the delay line (zeros) followed by the samples
+  // given to process(). d_next is the position, in that sequence, of the
+  // newest input of the next output.
+  d_edge.assign(2 * (d_ntaps - 1), gr_complex(0, 0));
+  d_next = d_ntaps - 1;
+}
+
+polyphase_resampler::~polyphase_resampler() { volk_free(d_taps); }
+
+size_t polyphase_resampler::process(const gr_complex *in, size_t n,
+                                    std::vector<gr_complex> &out) {
+  const size_t h = d_ntaps - 1;
+  const size_t first = out.size();
+
+  // The outputs that straddle the delay line and the new samples read from
+  // d_edge, the others straight from the input
+  memcpy(&d_edge[h], in, std::min(n, h) * sizeof(gr_complex));
+  while (d_next < h + n) {
+    size_t start = d_next - h;
+    const gr_complex *x = start >= h ? &in[start - h] : &d_edge[start];
+    lv_32fc_t y;
+    volk_32fc_32f_dot_prod_32fc(&y, x, &d_taps[d_phase * d_ntaps], d_ntaps);
+    out.push_back(y);
+
+    d_phase += d_decim;
+    d_next += d_phase / d_interp;
+    d_phase %= d_interp;
+  }
+
+  // Keep the last h samples as the next delay line
+  if (n >= h) {
+    memcpy(d_edge.data(), &in[n - h], h * sizeof(gr_complex));
+  } else {
+    memmove(d_edge.data(), &d_edge[n], h * sizeof(gr_complex));
+  }
+  d_next -= n;
+  return out.size() - first;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
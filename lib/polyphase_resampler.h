@@ -0,0 +1,81 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_POLYPHASE_RESAMPLER_H
+#define INCLUDED_FIRST_LORA_POLYPHASE_RESAMPLER_H
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define RESAMPLER_HALF_TAPS 8 // Taps on each side of the prototype, per output
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Kaiser windowed sinc lowpass with unit gain at DC
+ * @param ntaps Number of taps
+ * @param cutoff Cutoff frequency (-6 dB), relative to the sampling rate
+ * @return Taps, symmetric around (ntaps - 1) / 2
+ */
+FIRST_LORA_API std::vector<float> kaiser_lowpass(uint32_t ntaps, double cutoff);
+
+/**
+ * @brief Rational polyphase resampler (interpolate by L, decimate by M)
+ *
+ * Keeps its own delay line, so a stream can be fed in chunks of any size.
+ * Only the outputs are computed: each one is a single dot product of
+ * taps_per_phase input samples with one phase of the prototype filter.
+ */
+class FIRST_LORA_API polyphase_resampler {
+private:
+  uint32_t d_interp;                // L
+  uint32_t d_decim;                 // M
+  uint32_t d_ntaps;                 // Taps per phase (P)
+  float *d_taps;                    // L phases of P reversed taps (aligned)
+  std::vector<gr_complex> d_edge;   // Delay line followed by the next inputs
+  uint32_t d_phase = 0;             // Phase of the next output
+  size_t d_next;                    // Input ending the next output (see cc)
+
+public:
+  /**
+   * @param in_rate Input sampling rate
+   * @param out_rate Output sampling rate
+   */
+  polyphase_resampler(uint32_t in_rate, uint32_t out_rate);
+  ~polyphase_resampler();
+
+  polyphase_resampler(const polyphase_resampler &) = delete;
+  polyphase_resampler &operator=(const polyphase_resampler &) = delete;
+
+  /**
+   * @brief Resample n input samples, appending the outputs to out
+   * @return Number of outputs appended (at most max_output(n))
+   */
+  size_t process(const gr_complex *in, size_t n, std::vector<gr_complex> &out);
+
+  /** @brief Upper bound of the outputs of process() for n inputs */
+  size_t max_output(size_t n) const { return n * d_interp / d_decim + 1; }
+
+  /** @brief Group delay of the filter in input samples */
+  double delay() const {
+    return (d_ntaps * d_interp - 1) / (2.0 * d_interp);
+  }
+
+  uint32_t interpolation() const { return d_interp; }
+  uint32_t decimation() const { return d_decim; }
+  uint32_t taps_per_phase() const { return d_ntaps; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_POLYPHASE_RESAMPLER_H */
@@ -0,0 +1,240 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "chirp_cache.h"
+#include "lora_detector_impl.h"
+#include "qa_lora_signal.h"
+
+#include <gnuradio/io_signature.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/top_block.h>
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace gr::first_lora;
+
+namespace {
+
+// Allocations of every thread while g_counting is set, which
+// checked_detector does for the length of its general_work() calls once
+// warmed up. The worker_pool threads of the detector only run inside them.
+std::atomic<bool> g_counting{false};
+std::atomic<uint64_t> g_allocs{0};
+
+const uint32_t BW = 125000;
+const uint32_t FS = 2 * BW;
+const int PACKETS = 8;
+const int WARMUP_PACKETS = 2; // Packets before the allocations are counted
+
+/**
+ * @brief Source of a precomputed signal, done at its end
+ */
+class signal_source : public gr::sync_block {
+private:
+  std::vector<gr_complex> d_signal;
+  size_t d_pos = 0;
+
+public:
+  explicit signal_source(std::vector<gr_complex> signal)
+      : gr::sync_block("signal_source", gr::io_signature::make(0, 0, 0),
+                       gr::io_signature::make(1, 1, sizeof(gr_complex))),
+        d_signal(std::move(signal)) {}
+
+  int work(int noutput_items, gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items) override {
+    if (d_pos == d_signal.size()) {
+      return WORK_DONE;
+    }
+    size_t n = std::min<size_t>(noutput_items, d_signal.size() - d_pos);
+    memcpy(output_items[0], &d_signal[d_pos], n * sizeof(gr_complex));
+    d_pos += n;
+    return n;
+  }
+};
+
+/**
+ * @brief Sink counting the items of its input
+ */
+class count_sink : public gr::sync_block {
+public:
+  uint64_t items = 0;
+
+  count_sink()
+      : gr::sync_block("count_sink",
+                       gr::io_signature::make(1, 1, sizeof(gr_complex)),
+                       gr::io_signature::make(0, 0, 0)) {}
+
+  int work(int noutput_items, gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items) override {
+    items += noutput_items;
+    return noutput_items;
+  }
+};
+
+/**
+ * @brief lora_detector counting the allocations of general_work() once
+ * warmed up
+ */
+class checked_detector : public lora_detector_impl {
+private:
+  uint64_t d_warmup; // Input samples before counting
+
+public:
+  checked_detector(uint64_t warmup, int method, uint32_t samp_rate,
+                   int max_peaks, int hop, int nthreads)
+      : lora_detector_impl(0.1, 7, BW, method, true, PEAK_RESOLUTION, 0,
+                           samp_rate, max_peaks, hop, nthreads, false, false),
+        d_warmup(warmup) {}
+
+  int general_work(int noutput_items, gr_vector_int &ninput_items,
+                   gr_vector_const_void_star &input_items,
+                   gr_vector_void_star &output_items) override {
+    g_counting = nitems_read(0) >= d_warmup;
+    int ret = lora_detector_impl::general_work(noutput_items, ninput_items,
+                                               input_items, output_items);
+    g_counting = false;
+    return ret;
+  }
+};
+
+/**
+ * @brief Packets of SF7 between noise, one every period samples
+ */
+std::vector<gr_complex> make_signal(uint32_t period) {
+  auto chirps = get_chirp_table(7, BW, FS);
+  const uint32_t sn = chirps->n;
+  std::mt19937 rng(1234);
+  auto x = make_noise((size_t)PACKETS * period, 0.1f, rng);
+  for (int p = 0; p < PACKETS; p++) {
+    add_packet(x, *chirps, (size_t)p * period + 10 * sn + rng() % sn,
+               rng() % (1 << 7), 1.0f, rng);
+  }
+  return x;
+}
+
+/**
+ * @brief Run a detector over the packets, and check that every one of
+ * them is detected (the debug method detects nothing)
+ * @return Allocations after the warm-up
+ */
+uint64_t run(int method, uint32_t samp_rate, int max_peaks, int hop,
+             int nthreads) {
+  const uint32_t period = 60 * (2 << 7);
+  auto src = gnuradio::make_block_sptr<signal_source>(make_signal(period));
+  auto det = gnuradio::make_block_sptr<checked_detector>(
+      (uint64_t)WARMUP_PACKETS * period, method, samp_rate, max_peaks, hop,
+      nthreads);
+  auto sink = gnuradio::make_block_sptr<count_sink>();
+  det->set_stats_interval(0);
+
+  auto tb = gr::make_top_block("qa_lora_detector");
+  tb->connect(src, 0, det, 0);
+  tb->connect(det, 0, sink, 0);
+  g_allocs = 0;
+  tb->run();
+  if (method == 2) {
+    BOOST_CHECK_GT(det->nitems_written(0), 0);
+  } else {
+    BOOST_CHECK_EQUAL(det->stats()["detections"], PACKETS);
+  }
+  return g_allocs.load();
+}
+
+void count_alloc() {
+  if (g_counting.load(std::memory_order_relaxed)) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+} // namespace
+
+// Counting replacements of the C allocation functions. operator new and its
+// aligned forms (libstdc++), volk_malloc and liquid all allocate through
+// them. They forward to the glibc entry points, so elsewhere nothing is
+// counted.
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) noexcept {
+  count_alloc();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+  count_alloc();
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) noexcept {
+  count_alloc();
+  return __libc_realloc(p, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  count_alloc();
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  count_alloc();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size) noexcept {
+  count_alloc();
+  if (alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  *p = __libc_memalign(alignment, size);
+  return *p == NULL ? ENOMEM : 0;
+}
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_cpa) {
+  BOOST_CHECK_EQUAL(run(1, 0, 1, 1, 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_fpa) {
+  BOOST_CHECK_EQUAL(run(3, 0, 1, 1, 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_threads) {
+  BOOST_CHECK_EQUAL(run(1, 0, 1, 1, 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_fpa_threads) {
+  BOOST_CHECK_EQUAL(run(3, 0, 1, 1, 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_hop) {
+  BOOST_CHECK_EQUAL(run(1, 0, 1, 4, 2), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_max_peaks) {
+  BOOST_CHECK_EQUAL(run(1, 0, MAX_PEAKS, 1, 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_resampler) {
+  BOOST_CHECK_EQUAL(run(1, FS, 1, 1, 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_alloc_debug) {
+  BOOST_CHECK_EQUAL(run(2, 0, 1, 1, 1), 0);
+}
@@ -0,0 +1,79 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_QA_LORA_SIGNAL_H
+#define INCLUDED_FIRST_LORA_QA_LORA_SIGNAL_H
+
+#include "chirp_cache.h"
+
+#include <gnuradio/gr_complex.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Symbols of a packet from add_packet(), the last quarter downchirp aside
+#define QA_PACKET_SYMBOLS 32
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Add a LoRa packet to a signal of the unit tests: 8 upchirps, 2 sync
+ * words, 2.25 downchirps and random payload symbols
+ * @param s Signal to add it to, at least QA_PACKET_SYMBOLS + 1 symbols long
+ *          from start
+ * @param chirps Reference chirps of the packet
+ * @param start First sample of the preamble
+ * @param shift Symbol of the preamble, in bins
+ * @param amp Amplitude
+ * @param rng Source of the payload symbols
+ */
+inline void add_packet(std::vector<gr_complex> &s, const chirp_table &chirps,
+                       size_t start, uint32_t shift, float amp,
+                       std::mt19937 &rng) {
+  const uint32_t sn = chirps.n;
+  const uint32_t os = chirps.fs / chirps.bw;
+  size_t pos = start;
+  auto symbol = [&](uint32_t v, bool down, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++, pos++) {
+      gr_complex c = amp * chirps.up[(i + os * v) % sn];
+      s[pos] += down ? std::conj(c) : c;
+    }
+  };
+  for (int k = 0; k < 8; k++) {
+    symbol(shift, false, sn);
+  }
+  symbol(8 + shift, false, sn);
+  symbol(16 + shift, false, sn);
+  symbol(shift, true, sn);
+  symbol(shift, true, sn);
+  symbol(shift, true, sn / 4);
+  for (int k = 0; k < QA_PACKET_SYMBOLS - 12; k++) {
+    symbol(rng() % (1 << chirps.sf), false, sn);
+  }
+}
+
+/**
+ * @brief Complex white noise of the unit tests
+ * @param n Number of samples
+ * @param sigma Standard deviation of each of I and Q
+ */
+inline std::vector<gr_complex> make_noise(size_t n, float sigma,
+                                          std::mt19937 &rng) {
+  std::normal_distribution<float> noise(0, sigma);
+  std::vector<gr_complex> s(n);
+  for (auto &x : s) {
+    x = gr_complex(noise(rng), noise(rng));
+  }
+  return s;
+}
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_QA_LORA_SIGNAL_H */
@@ -0,0 +1,111 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "chirp_cache.h"
+#include "qa_lora_signal.h"
+#include "sync_detector.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+using namespace gr::first_lora;
+
+namespace {
+
+const uint32_t BW = 125000;
+const uint32_t OS = 2;
+
+/**
+ * @brief Step a detector through the signal like lora_detector does, and
+ * check that the window of every detection is within max_lag() of the
+ * window stepped, as much as lora_detector keeps in its history
+ * @return Number of detections
+ */
+int run(sync_detector &sync, const std::vector<gr_complex> &s) {
+  const uint32_t sn = sync.sn();
+  const int64_t lag = sync.max_lag();
+  int detections = 0;
+  // Room for the window of the detection before the symbol stepped
+  size_t pos = lag + (DEMOD_HISTORY - 1) * sn;
+  while (pos + sync.max_step() <= s.size()) {
+    uint32_t consumed = sync.step(&s[pos]);
+    if (sync.detected()) {
+      BOOST_CHECK_LE(sync.detection_offset(), 0);
+      BOOST_CHECK_GT(sync.detection_offset(), -lag);
+      detections++;
+    }
+    pos += consumed;
+  }
+  return detections;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_detection_offset_bound) {
+  // Every phase of the packet against the windows, for the offset of the
+  // SFD to take all its values
+  for (uint8_t sf : {7, 8}) {
+    for (uint32_t max_peaks : {2, 4}) {
+      std::mt19937 rng(sf * 10 + max_peaks);
+      auto chirps = get_chirp_table(sf, BW, OS * BW);
+      const uint32_t sn = chirps->n;
+      for (uint32_t phase = 0; phase < sn; phase += sn / 16) {
+        sync_detector sync(sf, BW, OS * BW, PEAK_RESOLUTION, max_peaks);
+        size_t start = 20 * sn + phase;
+        auto s = make_noise(start + 60 * sn, 0.25f, rng);
+        add_packet(s, *chirps, start, rng() % (1 << sf), 1.0f, rng);
+        BOOST_CHECK_EQUAL(run(sync, s), 1);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_detection_offset_collision) {
+  // Two packets of the same SF, the second one starting a fraction of a
+  // symbol later and weaker
+  const uint8_t sf = 7;
+  auto chirps = get_chirp_table(sf, BW, OS * BW);
+  const uint32_t sn = chirps->n;
+  std::mt19937 rng(1);
+  for (uint32_t delay = sn / 4; delay < 4 * sn; delay += sn / 3) {
+    sync_detector sync(sf, BW, OS * BW, PEAK_RESOLUTION, 4);
+    size_t start = 20 * sn + rng() % sn;
+    auto s = make_noise(start + delay + 60 * sn, 0.1f, rng);
+    add_packet(s, *chirps, start, 10, 1.0f, rng);
+    add_packet(s, *chirps, start + delay, 70, 0.7f, rng);
+    BOOST_CHECK_GE(run(sync, s), 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_sfd_search_gives_up_on_carrier) {
+  // An endless preamble, as an unmodulated carrier looks once dechirped:
+  // the SFD search must give up and the preamble search start again
+  const uint8_t sf = 7;
+  auto chirps = get_chirp_table(sf, BW, OS * BW);
+  const uint32_t sn = chirps->n;
+  for (uint32_t max_peaks : {1, 2}) {
+    sync_detector sync(sf, BW, OS * BW, PEAK_RESOLUTION, max_peaks);
+    std::vector<gr_complex> s(200 * sn);
+    for (size_t i = 0; i < s.size(); i++) {
+      s[i] = chirps->up[(i + OS * 30) % sn];
+    }
+    bool searched_sfd = false;
+    bool searched_again = false;
+    for (size_t pos = 0; pos + sync.max_step() <= s.size();) {
+      pos += sync.step(&s[pos]);
+      searched_sfd |= sync.state() == 2;
+      searched_again |= searched_sfd && sync.state() == 1;
+    }
+    BOOST_CHECK(!sync.detected());
+    BOOST_CHECK_GT(sync.stats().sfd_failed.load(), 1);
+    BOOST_CHECK_GT(sync.stats().preambles.load(), 1);
+    if (max_peaks == 1) {
+      BOOST_CHECK(searched_again);
+    }
+  }
+}
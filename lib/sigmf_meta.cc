@@ -0,0 +1,286 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sigmf_meta.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+void sigmf_json_string(const std::string &s, std::string &out) {
+  out += '"';
+  for (char c : s) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if ((unsigned char)c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+/**
+ * @brief Number as Python prints a float (868000000.0, 0.5)
+ */
+static void json_number(double x, std::string &out) {
+  char buf[32];
+  if (std::floor(x) == x && std::fabs(x) < 1e16) {
+    snprintf(buf, sizeof(buf), "%.1f", x);
+  } else {
+    snprintf(buf, sizeof(buf), "%.17g", x);
+  }
+  out += buf;
+}
+
+std::string sigmf_datatype(int item_size, bool is_complex) {
+  if (item_size == 8 && is_complex) {
+    return "cf32_le";
+  } else if (item_size == 4 && !is_complex) {
+    return "rf32_le";
+  } else if (item_size == 4) {
+    return "ci16_le";
+  } else if (item_size == 2 && !is_complex) {
+    return "ri16_le";
+  }
+  throw std::invalid_argument("sigmf: unsupported item type");
+}
+
+std::string sigmf_datetime(std::chrono::system_clock::time_point t) {
+  std::time_t sec = std::chrono::system_clock::to_time_t(t);
+  long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                t.time_since_epoch())
+                .count() %
+            1000000;
+  std::tm tm;
+  localtime_r(&sec, &tm);
+  char buf[48];
+  size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+  snprintf(buf + n, sizeof(buf) - n, ".%06ldZ", us);
+  return buf;
+}
+
+void sigmf_annotation_json(const sigmf_annotation &a, std::string &out) {
+  out += "{\"annotations\": {\"core:comment\": ";
+  sigmf_json_string(a.comment, out);
+  out += ", \"core:datetime\": ";
+  sigmf_json_string(a.datetime, out);
+  out += ", \"core:frequency\": ";
+  json_number(a.frequency, out);
+  out += "}, \"core:sample_count\": ";
+  out += std::to_string(a.sample_count);
+  out += ", \"core:sample_start\": ";
+  out += std::to_string(a.sample_start);
+  out += "}";
+}
+
+/**
+ * @brief What follows the annotations array: captures and global objects
+ */
+static void sigmf_tail(const sigmf_global &global, std::string &out) {
+  // Global keys in sorted order
+  const std::pair<const char *, const std::string *> keys[] = {
+      {"core:author", &global.author},
+      {"core:comment", &global.comment},
+      {"core:datatype", &global.datatype},
+      {"core:dataset", &global.dataset},
+      {"core:description", &global.description},
+      {"core:hw", &global.hw},
+      {"core:sample_rate", nullptr},
+      {"core:version", &global.version},
+  };
+  out += "    \"captures\": [],\n    \"global\": {\n";
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    out += "        \"";
+    out += keys[i].first;
+    out += "\": ";
+    if (keys[i].second != nullptr) {
+      sigmf_json_string(*keys[i].second, out);
+    } else {
+      json_number(global.sample_rate, out);
+    }
+    out += i + 1 < sizeof(keys) / sizeof(keys[0]) ? ",\n" : "\n";
+  }
+  out += "    }\n}";
+}
+
+static bool pwrite_all(int fd, const std::string &buf, uint64_t offset) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = pwrite(fd, buf.data() + done, buf.size() - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+sigmf_journal::sigmf_journal(const std::string &meta_path,
+                             const sigmf_global &global)
+    : d_meta_path(meta_path), d_journal_path(meta_path + ".journal") {
+  d_meta_fd = open(d_meta_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  d_journal_fd = open(d_journal_path.c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  d_read = (char *)malloc(JOURNAL_READ_SIZE);
+  if (d_meta_fd < 0 || d_journal_fd < 0 || d_read == NULL) {
+    release();
+    throw std::runtime_error("sigmf_journal: cannot create " + meta_path);
+  }
+  d_out.reserve(2 * JOURNAL_READ_SIZE);
+
+  // Valid from the start, with an empty annotations array
+  d_out = "{\n    \"annotations\": [";
+  d_array_end = d_out.size();
+  if (!compact(global)) {
+    release();
+    throw std::runtime_error("sigmf_journal: cannot write " + meta_path);
+  }
+}
+
+sigmf_journal::~sigmf_journal() { release(); }
+
+void sigmf_journal::release() {
+  if (d_meta_fd >= 0) {
+    ::close(d_meta_fd);
+    d_meta_fd = -1;
+  }
+  if (d_journal_fd >= 0) {
+    ::close(d_journal_fd);
+    d_journal_fd = -1;
+  }
+  free(d_read);
+  d_read = NULL;
+}
+
+void sigmf_journal::append(const sigmf_annotation &a) {
+  d_line.clear();
+  sigmf_annotation_json(a, d_line);
+  d_line += '\n';
+  // O_APPEND and a single write: a line is either whole or missing
+  size_t done = 0;
+  while (done < d_line.size()) {
+    ssize_t n = ::write(d_journal_fd, d_line.data() + done, d_line.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  d_journal_size += done;
+  d_count++;
+}
+
+bool sigmf_journal::compact(const sigmf_global &global) {
+  // d_out may already hold the head of the file (constructor)
+  uint64_t offset = d_out.empty() ? d_array_end : 0;
+
+  // Append the new lines as array elements, JOURNAL_READ_SIZE at a time.
+  // Each pass ends with the tail so the file is valid after every pwrite.
+  do {
+    size_t n = 0;
+    if (d_compacted < d_journal_size) {
+      ssize_t r = pread(d_journal_fd, d_read,
+                        std::min<uint64_t>(JOURNAL_READ_SIZE,
+                                           d_journal_size - d_compacted),
+                        d_compacted);
+      if (r < 0) {
+        return false;
+      }
+      n = r;
+    }
+    // Whole lines only, a partial one is read again by the next pass
+    uint64_t count = d_meta_count;
+    size_t start = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (d_read[i] != '\n') {
+        continue;
+      }
+      d_out += count == 0 ? "\n        " : ",\n        ";
+      d_out.append(&d_read[start], i - start);
+      count++;
+      start = i + 1;
+    }
+    const uint64_t array_end = offset + d_out.size();
+
+    d_out += count == 0 ? "],\n" : "\n    ],\n";
+    sigmf_tail(global, d_out);
+    if (!pwrite_all(d_meta_fd, d_out, offset) ||
+        ftruncate(d_meta_fd, offset + d_out.size()) != 0) {
+      d_out.clear();
+      return false;
+    }
+    d_compacted += start;
+    d_meta_count = count;
+    d_array_end = array_end;
+    offset = d_array_end;
+    d_out.clear();
+    if (start == 0) {
+      break; // Nothing left, or a line longer than the read buffer
+    }
+  } while (d_compacted < d_journal_size);
+
+  // Everything is in the .sigmf-meta, start the journal over
+  if (d_compacted == d_journal_size && d_compacted > 0 &&
+      ftruncate(d_journal_fd, 0) == 0) {
+    d_compacted = d_journal_size = 0;
+  }
+  return true;
+}
+
+bool sigmf_journal::close(const sigmf_global &global, bool keep_meta) {
+  bool ok = compact(global) && d_meta_count == d_count;
+  ::close(d_meta_fd);
+  ::close(d_journal_fd);
+  d_meta_fd = d_journal_fd = -1;
+  if (!keep_meta) {
+    unlink(d_meta_path.c_str());
+  }
+  if (ok || !keep_meta) {
+    unlink(d_journal_path.c_str());
+  }
+  return ok;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
@@ -0,0 +1,152 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_SIGMF_META_H
+#define INCLUDED_FIRST_LORA_SIGMF_META_H
+
+#include <gnuradio/first_lora/api.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define JOURNAL_READ_SIZE (64 << 10) // Journal bytes compacted at a time
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Global object of a .sigmf-meta file
+ */
+struct sigmf_global {
+  std::string datatype;    // core:datatype
+  double sample_rate = 0;  // core:sample_rate
+  std::string description; // core:description
+  std::string author;      // core:author
+  std::string dataset;     // core:dataset
+  std::string hw;          // core:hw
+  std::string version;     // core:version
+  std::string comment;     // core:comment
+};
+
+/**
+ * @brief One detection of a recording
+ *
+ * Laid out as file_writer.py wrote it through SigMFFile.add_annotation():
+ * the frequency, time and comment sit in a nested "annotations" object.
+ */
+struct sigmf_annotation {
+  uint64_t sample_start;  // core:sample_start
+  uint64_t sample_count;  // core:sample_count
+  double frequency;       // core:frequency
+  std::string datetime;   // core:datetime
+  std::string comment;    // core:comment
+};
+
+/**
+ * @brief SigMF datatype of a stream item
+ * @param item_size Item size in bytes (8, 4 or 2)
+ * @param is_complex Complex (I/Q) items
+ * @throws std::invalid_argument for other sizes
+ */
+FIRST_LORA_API std::string sigmf_datatype(int item_size, bool is_complex);
+
+/** @brief Local time as ISO 8601 with microseconds, followed by "Z" */
+FIRST_LORA_API std::string
+sigmf_datetime(std::chrono::system_clock::time_point t =
+                   std::chrono::system_clock::now());
+
+/**
+ * @brief Append a string to out as a quoted JSON string, with its quotes,
+ * backslashes and control characters escaped
+ */
+FIRST_LORA_API void sigmf_json_string(const std::string &s, std::string &out);
+
+/**
+ * @brief Append the JSON object of an annotation, on one line, to out
+ */
+FIRST_LORA_API void sigmf_annotation_json(const sigmf_annotation &a,
+                                          std::string &out);
+
+/**
+ * @brief Annotations of a recording, journaled to disk as they come
+ *
+ * Every annotation is appended at once, as one JSON line, to
+ * <meta>.journal: nothing is kept in memory and a crash loses at most what
+ * the kernel had not written back. compact() moves the lines not yet
+ * compacted into the annotations array of the .sigmf-meta file, which is
+ * laid out as SigMFFile.tofile() does (annotations, captures and global,
+ * keys sorted, four spaces indentation). The array is extended in place and
+ * only the captures and global objects after it are rewritten, so the cost
+ * of a compaction does not grow with the length of the recording.
+ *
+ * After compact() the .sigmf-meta file is complete and valid and the
+ * journal is emptied. If the process dies, the annotations are in the
+ * .sigmf-meta file up to the last compaction and in the journal after it;
+ * close() removes the journal.
+ *
+ * Every call does file I/O, compact() and close() as much as the journal
+ * holds: a journal is used by one thread at a time, never the one running
+ * the work() of a block.
+ */
+class FIRST_LORA_API sigmf_journal {
+private:
+  std::string d_meta_path;    // .sigmf-meta file
+  std::string d_journal_path; // Annotations not compacted yet, JSON lines
+  int d_meta_fd = -1;
+  int d_journal_fd = -1;
+  uint64_t d_journal_size = 0; // Bytes appended to the journal
+  uint64_t d_compacted = 0;    // Journal bytes already in the .sigmf-meta
+  uint64_t d_array_end = 0;    // .sigmf-meta offset after the last element
+  uint64_t d_count = 0;        // Annotations appended
+  uint64_t d_meta_count = 0;   // Annotations in the .sigmf-meta
+  std::string d_line;          // Scratch of append(), reused
+  std::string d_out;           // Scratch of compact(), reused
+  char *d_read = nullptr;      // JOURNAL_READ_SIZE bytes of journal
+
+  void release();
+
+public:
+  /**
+   * @brief Create (truncate) the .sigmf-meta file and its journal
+   * @throws std::runtime_error if either cannot be created
+   */
+  sigmf_journal(const std::string &meta_path, const sigmf_global &global);
+  /** @brief Compacts nothing, keeps the journal if close() was not called */
+  ~sigmf_journal();
+
+  sigmf_journal(const sigmf_journal &) = delete;
+  sigmf_journal &operator=(const sigmf_journal &) = delete;
+
+  /** @brief Journal one annotation (a single write) */
+  void append(const sigmf_annotation &a);
+
+  /**
+   * @brief Bring the .sigmf-meta file up to date with the journal
+   * @param global Global object, rewritten after the annotations
+   * @return false on an I/O error, the journal is kept
+   */
+  bool compact(const sigmf_global &global);
+
+  /**
+   * @brief Compact, close both files and remove the journal
+   * @param keep_meta Keep the .sigmf-meta file (else it is removed too)
+   */
+  bool close(const sigmf_global &global, bool keep_meta = true);
+
+  /** @brief Annotations appended so far */
+  uint64_t count() const { return d_count; }
+
+  /** @brief Annotations appended since the last compact() */
+  uint64_t pending() const { return d_count - d_meta_count; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_SIGMF_META_H */
@@ -0,0 +1,456 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sigmf_writer_impl.h"
+#include "async_logger.h"
+
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+sigmf_writer::sptr
+sigmf_writer::make(const std::string &filename, const std::string &author,
+                   const std::string &description, int item_size,
+                   bool item_type, double sample_rate, double frequency,
+                   const std::string &hw, const std::string &version,
+                   int num_inputs, bool is_loopback,
+                   const std::string &ip_address, int port) {
+  return gnuradio::make_block_sptr<sigmf_writer_impl>(
+      filename, author, description, item_size, item_type, sample_rate,
+      frequency, hw, version, num_inputs, is_loopback, ip_address, port);
+}
+
+/*
+ * The private constructor
+ */
+sigmf_writer_impl::sigmf_writer_impl(
+    const std::string &filename, const std::string &author,
+    const std::string &description, int item_size, bool item_type,
+    double sample_rate, double frequency, const std::string &hw,
+    const std::string &version, int num_inputs, bool is_loopback,
+    const std::string &ip_address, int port)
+    : gr::sync_block("sigmf_writer",
+                     gr::io_signature::make(num_inputs, num_inputs, item_size),
+                     gr::io_signature::make(0, 0, 0)),
+      d_filename(filename), d_frequency(frequency), d_item_size(item_size),
+      d_inputs(std::max(num_inputs, 0)), d_writer(std::max(num_inputs, 0)),
+      d_meta_base(filename), d_meta(std::max(num_inputs, 0)),
+      d_loopback(is_loopback),
+      d_address(ip_address), d_port(port) {
+  if (num_inputs < 1) {
+    throw std::invalid_argument("sigmf_writer: at least one input is needed");
+  }
+  d_global.datatype = sigmf_datatype(item_size, item_type);
+  d_global.sample_rate = sample_rate;
+  d_global.description = description;
+  d_global.author = author;
+  d_global.hw = hw;
+  d_global.version = version;
+
+  // One handler per input, each knowing its port
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    d_inputs[i].port =
+        num_inputs == 1 ? "detected" : "detected" + std::to_string(i);
+    pmt::pmt_t port = pmt::mp(d_inputs[i].port);
+    message_port_register_in(port);
+    set_msg_handler(port, [this, i](const pmt::pmt_t &msg) {
+      handle_msg(i, msg);
+    });
+  }
+
+  // Never overwrite a previous recording
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    if (access(data_path(d_meta_base, i).c_str(), F_OK) == 0) {
+      d_meta_base = d_filename + "_" + std::to_string(time(NULL));
+      break;
+    }
+  }
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    d_writer.open(i, data_path(d_meta_base, i));
+    d_meta[i].journal = std::make_unique<sigmf_journal>(
+        meta_path(d_meta_base, i), global(d_meta_base, i, 0));
+  }
+  d_next_compact = std::chrono::steady_clock::now() +
+                   std::chrono::seconds(SIGMF_COMPACT_PERIOD);
+
+  // Rotations only swap pointers in work(): size the queues up front
+  for (rotation &r : d_rotations.slots()) {
+    r.paths.resize(d_inputs.size());
+    r.journals.resize(d_inputs.size());
+  }
+  for (switched &s : d_switched.slots()) {
+    s.written.resize(d_inputs.size());
+    s.journals.resize(d_inputs.size());
+  }
+  d_meta_thread = std::thread(&sigmf_writer_impl::meta_loop, this);
+  log_info("sigmf_writer", "Recording {} inputs", d_inputs.size());
+}
+
+/*
+ * Our virtual destructor.
+ */
+sigmf_writer_impl::~sigmf_writer_impl() { finish(); }
+
+std::string sigmf_writer_impl::data_path(const std::string &base,
+                                         size_t input) const {
+  return base + "_input" + std::to_string(input) + ".sigmf-data";
+}
+
+std::string sigmf_writer_impl::meta_path(const std::string &base,
+                                         size_t input) const {
+  return base + "_input" + std::to_string(input) + ".sigmf-meta";
+}
+
+sigmf_global sigmf_writer_impl::global(const std::string &base, size_t input,
+                                       uint64_t packets) const {
+  sigmf_global global = d_global;
+  global.dataset = data_path(base, input);
+  global.comment = "Total number of symbols: " + std::to_string(packets);
+  return global;
+}
+
+void sigmf_writer_impl::compact() {
+  for (size_t i = 0; i < d_meta.size(); i++) {
+    meta_state &m = d_meta[i];
+    if (m.journal && m.journal->pending() > 0 &&
+        !m.journal->compact(global(d_meta_base, i, m.packets))) {
+      log_error("sigmf_writer", "Cannot update the metadata of input {}", i);
+    }
+  }
+  d_next_compact = std::chrono::steady_clock::now() +
+                   std::chrono::seconds(SIGMF_COMPACT_PERIOD);
+}
+
+void sigmf_writer_impl::meta_loop() {
+  std::unique_lock<std::mutex> lock(d_meta_mutex);
+  while (!d_meta_stop) {
+    lock.unlock();
+    drain();
+    // Keep the .sigmf-meta files usable during long recordings
+    bool compact_now = std::chrono::steady_clock::now() >= d_next_compact;
+    for (const meta_state &m : d_meta) {
+      compact_now |=
+          m.journal && m.journal->pending() >= SIGMF_COMPACT_ANNOTATIONS;
+    }
+    if (compact_now) {
+      compact();
+    }
+    lock.lock();
+    // work() never wakes this thread, an annotation waits a period at most
+    d_meta_cv.wait_for(lock, std::chrono::milliseconds(SIGMF_META_PERIOD_MS),
+                       [this] { return d_meta_stop; });
+  }
+  lock.unlock();
+  drain();
+}
+
+void sigmf_writer_impl::drain() {
+  uint64_t dropped = d_dropped.load(std::memory_order_relaxed);
+  if (dropped != d_dropped_reported) {
+    log_warning("sigmf_writer",
+                "{} annotations dropped, the metadata thread is behind",
+                dropped - d_dropped_reported);
+    d_dropped_reported = dropped;
+  }
+  while (true) {
+    annotation *a = d_annotations.front();
+    if (a != nullptr) {
+      // The files of its rotation were queued before it
+      while (d_meta_generation < a->generation) {
+        switch_files(*d_switched.front());
+        d_switched.pop();
+      }
+      meta_state &m = d_meta[a->input];
+      m.packets++;
+      m.journal->append({a->sample, SIGMF_ANNOTATION_LENGTH, d_frequency,
+                         sigmf_datetime(a->time),
+                         "LoRa Symbol " + std::to_string(m.packets)});
+      d_annotations.pop();
+      continue;
+    }
+    switched *s = d_switched.front();
+    if (s == nullptr) {
+      return;
+    }
+    // The annotations queued before the switch are visible now
+    if (!d_annotations.empty()) {
+      continue;
+    }
+    switch_files(*s);
+    d_switched.pop();
+  }
+}
+
+void sigmf_writer_impl::switch_files(switched &s) {
+  for (size_t i = 0; i < d_meta.size(); i++) {
+    meta_state &m = d_meta[i];
+    if (!m.journal->close(global(d_meta_base, i, m.packets),
+                          s.written[i] > 0)) {
+      log_error("sigmf_writer", "Cannot write the metadata of input {}", i);
+    }
+    // None when the recording ends
+    m.journal = std::move(s.journals[i]);
+    m.packets = 0;
+  }
+  if (!s.close) {
+    std::swap(d_meta_base, s.base);
+  }
+  d_meta_generation++;
+  d_rotated.store(d_meta_generation, std::memory_order_release);
+  if (d_server) {
+    d_server->wake();
+  }
+}
+
+void sigmf_writer_impl::handle_msg(size_t input, const pmt::pmt_t &msg) {
+  // Detectors publish either true or a dict with a "detected" key
+  pmt::pmt_t detected = msg;
+  if (pmt::is_dict(msg)) {
+    detected = pmt::dict_ref(msg, pmt::mp("detected"), pmt::PMT_F);
+  }
+  if (pmt::is_bool(detected) && pmt::to_bool(detected)) {
+    d_inputs[input].new_packet = true;
+  }
+}
+
+bool sigmf_writer_impl::start() {
+  if (!d_loopback || d_server) {
+    return true;
+  }
+  // Clients connect whenever they want, start-up does not wait for them
+  d_server = std::make_unique<control_server>(
+      [this](const std::string &cmd) { return handle_command(cmd); },
+      [this] { reap_rotations(); });
+  return d_server->start(d_address, d_port);
+}
+
+std::string sigmf_writer_impl::handle_command(const std::string &cmd) {
+  if (cmd == "position") {
+    return std::to_string(d_published.load(std::memory_order_relaxed)) + "\n";
+  }
+
+  // "close", "<device id>" or "<device id> <first sample>"
+  const bool close = cmd == "close";
+  long long device = 0;
+  unsigned long long at = 0;
+  if (!close && sscanf(cmd.c_str(), "%lld %llu", &device, &at) < 1) {
+    log_error("sigmf_writer", "Unknown command");
+    return "ERR";
+  }
+  if ((!close && device == d_device) || d_close_requested) {
+    return "ACK";
+  }
+  rotation *r = d_rotations.back();
+  if (r == nullptr || d_outstanding >= ROTATION_QUEUE_SIZE) {
+    return "BUSY";
+  }
+
+  r->close = close;
+  r->at = at;
+  if (!close) {
+    log_info("sigmf_writer", "Device id changed from {} to {}", d_device,
+             device);
+    r->base = d_filename + "_device_" + std::to_string(device);
+    // If the file exists, append a timestamp to the filename
+    for (size_t i = 0; i < d_inputs.size(); i++) {
+      if (access(data_path(r->base, i).c_str(), F_OK) == 0) {
+        r->base += "_" + std::to_string(time(NULL));
+        break;
+      }
+    }
+    try {
+      for (size_t i = 0; i < d_inputs.size(); i++) {
+        r->paths[i] = data_path(r->base, i);
+        r->journals[i] = std::make_unique<sigmf_journal>(
+            meta_path(r->base, i), global(r->base, i, 0));
+      }
+    } catch (const std::exception &) {
+      log_error("sigmf_writer", "Cannot create the files of device {}",
+                device);
+      for (auto &j : r->journals) {
+        if (j) {
+          j->close(d_global, false);
+          j.reset();
+        }
+      }
+      return "ERR";
+    }
+    d_device = device;
+  }
+  d_close_requested = close;
+  d_outstanding++;
+  d_rotations.push();
+  return "ACK";
+}
+
+void sigmf_writer_impl::reap_rotations() {
+  uint64_t rotated = d_rotated.load(std::memory_order_acquire);
+  if (rotated == d_reaped) {
+    return;
+  }
+  d_outstanding -= (int)(rotated - d_reaped);
+  d_reaped = rotated;
+  if (d_close_requested && d_outstanding == 0) {
+    log_info("sigmf_writer", "Closing connection");
+    d_server->drop_clients();
+  }
+}
+
+void sigmf_writer_impl::rotate(rotation &r) {
+  // d_switched has room: there are never more rotations in flight than
+  // slots
+  switched &s = *d_switched.back();
+  s.close = r.close;
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    s.written[i] = d_inputs[i].written;
+  }
+
+  if (r.close) {
+    for (size_t i = 0; i < d_inputs.size(); i++) {
+      d_writer.close(i);
+    }
+    d_closed = true;
+  } else {
+    std::swap(s.base, r.base);
+    for (size_t i = 0; i < d_inputs.size(); i++) {
+      input_state &in = d_inputs[i];
+      d_writer.open(i, std::move(r.paths[i]));
+      std::swap(s.journals[i], r.journals[i]);
+      in.written = 0;
+      in.new_packet = true;
+    }
+  }
+  d_switched.push();
+  d_generation++;
+}
+
+void sigmf_writer_impl::finish() {
+  if (d_finished) {
+    return;
+  }
+  d_finished = true;
+  if (d_server) {
+    d_server->stop();
+  }
+  // The metadata thread journals and switches what work() queued first
+  {
+    std::lock_guard<std::mutex> lock(d_meta_mutex);
+    d_meta_stop = true;
+  }
+  d_meta_cv.notify_one();
+  d_meta_thread.join();
+  if (d_server) {
+    // After stop() the server thread is gone and this thread owns its side
+    for (rotation *r = d_rotations.front(); r != nullptr;
+         r = d_rotations.front()) {
+      for (auto &j : r->journals) {
+        if (j) {
+          j->close(d_global, false);
+          j.reset();
+        }
+      }
+      d_rotations.pop();
+    }
+  }
+  if (d_closed) {
+    return;
+  }
+
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    d_writer.close(i);
+  }
+  d_writer.flush();
+
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    input_state &in = d_inputs[i];
+    meta_state &m = d_meta[i];
+    if (in.written == 0) {
+      log_info("sigmf_writer", "No data written on input {}", i);
+    }
+    if (!m.journal->close(global(d_meta_base, i, m.packets),
+                          in.written > 0)) {
+      log_error("sigmf_writer", "Cannot write the metadata of input {}", i);
+    }
+  }
+}
+
+bool sigmf_writer_impl::stop() {
+  finish();
+  return true;
+}
+
+void sigmf_writer_impl::record(gr_vector_const_void_star &input_items,
+                               int from, int to) {
+  for (size_t i = 0; i < d_inputs.size(); i++) {
+    input_state &in = d_inputs[i];
+    if (in.new_packet) {
+      // Journaled by the metadata thread. When it is that far behind, the
+      // annotation is dropped rather than stalling the flowgraph, and
+      // counted for the metadata thread to report.
+      annotation *a = d_annotations.back();
+      if (a != nullptr) {
+        *a = {(uint32_t)i, d_generation, in.written,
+              std::chrono::system_clock::now()};
+        d_annotations.push();
+      } else {
+        d_dropped.store(d_dropped.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+      }
+      in.new_packet = false;
+    }
+    d_writer.write(i, (const char *)input_items[i] + from * d_item_size,
+                   (to - from) * d_item_size);
+    in.written += to - from;
+  }
+}
+
+int sigmf_writer_impl::work(int noutput_items,
+                            gr_vector_const_void_star &input_items,
+                            gr_vector_void_star &output_items) {
+  if (d_closed) {
+    return WORK_DONE;
+  }
+
+  // Split the call at the first sample of each queued rotation
+  int done = 0;
+  while (done < noutput_items) {
+    int end = noutput_items;
+    rotation *r = d_rotations.front();
+    if (r != nullptr) {
+      if (r->at <= d_position) {
+        rotate(*r);
+        d_rotations.pop();
+        if (d_closed) {
+          // The rest of the call is not recorded
+          d_published.store(d_position, std::memory_order_relaxed);
+          return done > 0 ? done : WORK_DONE;
+        }
+        continue;
+      }
+      if (r->at < d_position + (noutput_items - done)) {
+        end = done + (int)(r->at - d_position);
+      }
+    }
+    record(input_items, done, end);
+    d_position += end - done;
+    done = end;
+  }
+  d_published.store(d_position, std::memory_order_relaxed);
+  return noutput_items;
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
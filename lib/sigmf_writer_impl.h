@@ -0,0 +1,199 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_SIGMF_WRITER_IMPL_H
+#define INCLUDED_FIRST_LORA_SIGMF_WRITER_IMPL_H
+
+#include "control_server.h"
+#include "sigmf_meta.h"
+#include "spsc_ring.h"
+#include "stream_writer.h"
+
+#include <gnuradio/first_lora/sigmf_writer.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Samples covered by an annotation, as in file_writer
+#define SIGMF_ANNOTATION_LENGTH (256 * 13 * 4)
+#define SIGMF_COMPACT_PERIOD 10       // Seconds between metadata updates
+#define SIGMF_COMPACT_ANNOTATIONS 256 // Or annotations between updates
+#define ROTATION_QUEUE_SIZE 8         // File switches queued for work()
+#define ANNOTATION_QUEUE_SIZE 1024    // Annotations queued by work()
+#define SIGMF_META_PERIOD_MS 50       // Metadata thread polling period
+
+namespace gr {
+namespace first_lora {
+
+class sigmf_writer_impl : public sigmf_writer {
+private:
+  /**
+   * @brief Recording of one input
+   */
+  struct input_state {
+    std::string port;                     // Name of the message port
+    bool new_packet = true;               // Annotate the next sample
+    uint64_t written = 0;                 // Samples in the file
+  };
+
+  /**
+   * @brief Metadata of one input, owned by the metadata thread
+   */
+  struct meta_state {
+    uint64_t packets = 0;                   // Annotations so far
+    std::unique_ptr<sigmf_journal> journal; // Annotations and .sigmf-meta
+  };
+
+  /**
+   * @brief Detection queued by work() for the metadata thread
+   *
+   * Fixed size: the strings of the annotation and the journal write are
+   * left to the metadata thread.
+   */
+  struct annotation {
+    uint32_t input;       // Input of the detection
+    uint64_t generation;  // Rotations before it
+    uint64_t sample;      // First sample, in the file
+    std::chrono::system_clock::time_point time; // Time of the detection
+  };
+
+  /**
+   * @brief Switch to new files, prepared by the control thread
+   *
+   * Everything that needs a file system call or an allocation is done
+   * before it is queued, work() only swaps it in.
+   */
+  struct rotation {
+    bool close = false;       // End the recording instead
+    uint64_t at = 0;          // First sample of the new files (0: now)
+    std::string base;         // Base name of the new files
+    std::vector<std::string> paths; // Data file of each input
+    std::vector<std::unique_ptr<sigmf_journal>> journals; // New journals
+  };
+
+  /**
+   * @brief Metadata files of a rotation, switched by the metadata thread
+   *
+   * Annotations of an older generation go to the files before it.
+   */
+  struct switched {
+    bool close = false;       // End the recording instead
+    std::string base;         // Base name of the new files
+    std::vector<uint64_t> written; // Samples in each data file left
+    std::vector<std::unique_ptr<sigmf_journal>> journals; // New journals
+  };
+
+  std::string d_filename;          // Base name given by the user
+  sigmf_global d_global;           // Global fields shared by the inputs
+  double d_frequency;              // Frequency of the annotations
+  size_t d_item_size;              // Bytes per item
+  std::vector<input_state> d_inputs;
+  stream_writer d_writer;          // Data files
+  bool d_finished = false;         // Metadata written by stop()
+  bool d_closed = false;           // Recording ended by a "close" command
+  uint64_t d_position = 0;         // Samples consumed on each input
+  std::atomic<uint64_t> d_published{0}; // d_position for the control thread
+  uint64_t d_generation = 0;       // Rotations swapped in by work()
+
+  // Metadata thread: journals the annotations and updates the .sigmf-meta
+  // files, so work() never waits for the disk
+  std::string d_meta_base;         // Base name of the metadata files
+  std::vector<meta_state> d_meta;
+  uint64_t d_meta_generation = 0;  // Rotations switched
+  std::chrono::steady_clock::time_point d_next_compact; // Next update
+  spsc_ring<annotation, ANNOTATION_QUEUE_SIZE> d_annotations; // From work()
+  spsc_ring<switched, ROTATION_QUEUE_SIZE> d_switched;        // From work()
+  std::atomic<uint64_t> d_rotated{0}; // Rotations switched, for the
+                                      // control thread
+  std::atomic<uint64_t> d_dropped{0}; // Annotations lost to a full queue
+                                      // (written by work())
+  uint64_t d_dropped_reported = 0; // Of them, logged (metadata thread)
+  bool d_meta_stop = false;
+  std::mutex d_meta_mutex;
+  std::condition_variable d_meta_cv; // Stop
+  std::thread d_meta_thread;
+
+  // Loopback control (device id rotation)
+  bool d_loopback;
+  std::string d_address;
+  int d_port;
+  std::unique_ptr<control_server> d_server;
+  spsc_ring<rotation, ROTATION_QUEUE_SIZE> d_rotations; // To work()
+  int d_outstanding = 0;           // Rotations not switched (control thread)
+  uint64_t d_reaped = 0;           // Switches counted (control thread)
+  int64_t d_device = 0;            // Current device id (control thread)
+  bool d_close_requested = false;  // "close" received (control thread)
+
+  void handle_msg(size_t input, const pmt::pmt_t &msg);
+
+  std::string data_path(const std::string &base, size_t input) const;
+  std::string meta_path(const std::string &base, size_t input) const;
+
+  /** @brief Global object of the .sigmf-meta of an input */
+  sigmf_global global(const std::string &base, size_t input,
+                      uint64_t packets) const;
+
+  /**
+   * @brief Write the annotations journaled so far to the .sigmf-meta
+   * (metadata thread, it reads and rewrites the files)
+   */
+  void compact();
+
+  /** @brief Journal the annotations queued by work() (metadata thread) */
+  void meta_loop();
+
+  /**
+   * @brief Journal and switch everything queued so far, and log the
+   * annotations dropped since the last call (metadata thread)
+   */
+  void drain();
+
+  /** @brief Close the metadata files and switch to those of a rotation */
+  void switch_files(switched &s);
+
+  /** @brief Append samples [from, to) of every input to the files */
+  void record(gr_vector_const_void_star &input_items, int from, int to);
+
+  /** @brief Swap in the files of a rotation (work thread) */
+  void rotate(rotation &r);
+
+  /** @brief Handle a command of the control channel (control thread) */
+  std::string handle_command(const std::string &cmd);
+
+  /** @brief Count the rotations switched (control thread) */
+  void reap_rotations();
+
+  /** @brief Flush the data and write the .sigmf-meta of every input */
+  void finish();
+
+public:
+  sigmf_writer_impl(const std::string &filename, const std::string &author,
+                    const std::string &description, int item_size,
+                    bool item_type, double sample_rate, double frequency,
+                    const std::string &hw, const std::string &version,
+                    int num_inputs, bool is_loopback,
+                    const std::string &ip_address, int port);
+  ~sigmf_writer_impl();
+
+  bool start() override;
+  bool stop() override;
+
+  int work(int noutput_items, gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_SIGMF_WRITER_IMPL_H */
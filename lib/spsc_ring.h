@@ -0,0 +1,76 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_SPSC_RING_H
+#define INCLUDED_FIRST_LORA_SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Bounded single producer, single consumer queue
+ *
+ * The slots are allocated once; an element is filled in place by the
+ * producer and read in place by the consumer, so neither side allocates,
+ * locks or copies more than it asks to. N must be a power of two.
+ */
+template <typename T, size_t N> class spsc_ring {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+private:
+  std::array<T, N> d_slots;
+  alignas(64) std::atomic<size_t> d_head{0}; // Next slot to fill (producer)
+  alignas(64) std::atomic<size_t> d_tail{0}; // Next slot to read (consumer)
+
+public:
+  /** @brief Slot to fill, nullptr if the ring is full (producer) */
+  T *back() {
+    size_t head = d_head.load(std::memory_order_relaxed);
+    if (head - d_tail.load(std::memory_order_acquire) == N) {
+      return nullptr;
+    }
+    return &d_slots[head % N];
+  }
+
+  /** @brief Publish the slot returned by back() (producer) */
+  void push() {
+    d_head.store(d_head.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_release);
+  }
+
+  /** @brief Oldest element, nullptr if the ring is empty (consumer) */
+  T *front() {
+    size_t tail = d_tail.load(std::memory_order_relaxed);
+    if (tail == d_head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &d_slots[tail % N];
+  }
+
+  /** @brief Release the element returned by front() (consumer) */
+  void pop() {
+    d_tail.store(d_tail.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_release);
+  }
+
+  bool empty() const {
+    return d_tail.load(std::memory_order_acquire) ==
+           d_head.load(std::memory_order_acquire);
+  }
+
+  /** @brief Every slot, to size them up front */
+  std::array<T, N> &slots() { return d_slots; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_SPSC_RING_H */
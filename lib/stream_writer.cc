@@ -0,0 +1,196 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "stream_writer.h"
+#include "async_logger.h"
+
+#include <volk/volk_malloc.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace gr {
+namespace first_lora {
+
+stream_writer::stream_writer(size_t nstreams, size_t buffer_size)
+    : d_buffer_size(buffer_size), d_streams(nstreams),
+      d_jobs(4 * nstreams + 4) {
+  if (buffer_size == 0 || buffer_size % WRITER_ALIGNMENT != 0) {
+    throw std::invalid_argument(
+        "stream_writer: buffer size must be a multiple of the alignment");
+  }
+  for (stream &st : d_streams) {
+    for (char *&b : st.buffers) {
+      b = (char *)volk_malloc(d_buffer_size, WRITER_ALIGNMENT);
+      if (b == NULL) {
+        throw std::bad_alloc();
+      }
+    }
+  }
+  d_thread = std::thread(&stream_writer::writer_loop, this);
+}
+
+stream_writer::~stream_writer() {
+  for (size_t s = 0; s < d_streams.size(); s++) {
+    close(s);
+  }
+  {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    d_stop = true;
+  }
+  d_cv_job.notify_one();
+  d_thread.join();
+  for (stream &st : d_streams) {
+    volk_free(st.buffers[0]);
+    volk_free(st.buffers[1]);
+  }
+}
+
+void stream_writer::push(job &&j) {
+  std::unique_lock<std::mutex> lock(d_mutex);
+  d_cv_done.wait(lock, [this] { return d_count < d_jobs.size(); });
+  d_jobs[(d_head + d_count) % d_jobs.size()] = std::move(j);
+  d_count++;
+  lock.unlock();
+  d_cv_job.notify_one();
+}
+
+void stream_writer::submit(size_t s) {
+  stream &st = d_streams[s];
+  if (st.fill == 0) {
+    return;
+  }
+  const int b = st.active;
+  {
+    std::unique_lock<std::mutex> lock(d_mutex);
+    // The writer thread must be done with the other buffer before it can
+    // be filled: this is the only place the caller waits for the disk
+    d_cv_done.wait(lock, [&] { return !st.pending[1 - b]; });
+    st.pending[b] = true;
+  }
+  push({job_type::WRITE, s, b, st.fill, std::string()});
+  st.active = 1 - b;
+  st.fill = 0;
+}
+
+void stream_writer::open(size_t s, std::string path) {
+  submit(s);
+  d_streams[s].bytes = 0;
+  push({job_type::OPEN, s, 0, 0, std::move(path)});
+}
+
+void stream_writer::close(size_t s) {
+  submit(s);
+  push({job_type::CLOSE, s, 0, 0, std::string()});
+}
+
+void stream_writer::write(size_t s, const void *data, size_t bytes) {
+  stream &st = d_streams[s];
+  const char *p = (const char *)data;
+  st.bytes += bytes;
+  while (bytes > 0) {
+    size_t n = std::min(bytes, d_buffer_size - st.fill);
+    memcpy(st.buffers[st.active] + st.fill, p, n);
+    st.fill += n;
+    p += n;
+    bytes -= n;
+    if (st.fill == d_buffer_size) {
+      submit(s);
+    }
+  }
+}
+
+void stream_writer::flush() {
+  for (size_t s = 0; s < d_streams.size(); s++) {
+    submit(s);
+  }
+  push({job_type::SYNC, 0, 0, 0, std::string()});
+  std::unique_lock<std::mutex> lock(d_mutex);
+  d_cv_done.wait(lock, [this] { return d_count == 0; });
+}
+
+uint64_t stream_writer::errors() {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  return d_errors;
+}
+
+void stream_writer::run(const job &j) {
+  stream &st = d_streams[j.stream];
+  switch (j.type) {
+  case job_type::OPEN:
+    if (st.fd >= 0) {
+      ::close(st.fd);
+    }
+    st.fd = ::open(j.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+    if (st.fd < 0) {
+      log_error("stream_writer", "Cannot create the file of stream {}: {}",
+                j.stream, errno);
+      std::lock_guard<std::mutex> lock(d_mutex);
+      d_errors++;
+    }
+    break;
+  case job_type::CLOSE:
+    if (st.fd >= 0) {
+      ::close(st.fd);
+      st.fd = -1;
+    }
+    break;
+  case job_type::WRITE: {
+    const char *p = st.buffers[j.buffer];
+    size_t left = j.bytes;
+    while (left > 0 && st.fd >= 0) {
+      ssize_t n = ::write(st.fd, p, left);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        log_error("stream_writer", "Write to stream {} failed: {}", j.stream,
+                  errno);
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_errors++;
+        break;
+      }
+      p += n;
+      left -= n;
+    }
+    break;
+  }
+  case job_type::SYNC:
+    break;
+  }
+}
+
+void stream_writer::writer_loop() {
+  std::unique_lock<std::mutex> lock(d_mutex);
+  while (true) {
+    d_cv_job.wait(lock, [this] { return d_count > 0 || d_stop; });
+    if (d_count == 0) {
+      return;
+    }
+    // The job stays in the ring until it is done so flush() sees it
+    const job &j = d_jobs[d_head];
+    lock.unlock();
+    run(j);
+    lock.lock();
+    if (j.type == job_type::WRITE) {
+      d_streams[j.stream].pending[j.buffer] = false;
+    }
+    d_head = (d_head + 1) % d_jobs.size();
+    d_count--;
+    d_cv_done.notify_all();
+  }
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
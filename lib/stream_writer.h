@@ -0,0 +1,123 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_STREAM_WRITER_H
+#define INCLUDED_FIRST_LORA_STREAM_WRITER_H
+
+#include <gnuradio/first_lora/api.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define WRITER_BUFFER_SIZE (4 << 20) // Bytes per buffer, two per stream
+#define WRITER_ALIGNMENT 4096        // Buffer alignment (page)
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Files written by a background thread from double buffers
+ *
+ * Each stream has two page aligned buffers. The caller fills one while the
+ * writer thread empties the other with a single large write(), so the
+ * caller only copies memory and waits only when the disk is slower than
+ * the stream. Opening and closing a file go through the same queue as the
+ * data, in order, so a file can be switched between two writes without
+ * waiting for the previous one to be flushed.
+ */
+class FIRST_LORA_API stream_writer {
+private:
+  enum class job_type { WRITE, OPEN, CLOSE, SYNC };
+
+  struct job {
+    job_type type;
+    size_t stream;
+    int buffer;       // WRITE: buffer to write
+    size_t bytes;     // WRITE: bytes in the buffer
+    std::string path; // OPEN: file to create
+  };
+
+  struct stream {
+    int fd = -1;                    // Current file (writer thread only)
+    char *buffers[2] = {};          // Double buffer
+    bool pending[2] = {};           // Buffer queued or being written
+    int active = 0;                 // Buffer being filled
+    size_t fill = 0;                // Bytes in the active buffer
+    uint64_t bytes = 0;             // Bytes given to the current file
+  };
+
+  size_t d_buffer_size;
+  std::vector<stream> d_streams;
+  std::vector<job> d_jobs;          // Ring of queued jobs
+  size_t d_head = 0;                // Next job to run
+  size_t d_count = 0;               // Jobs queued
+  uint64_t d_errors = 0;            // Failed open/write calls
+  bool d_stop = false;
+  std::mutex d_mutex;
+  std::condition_variable d_cv_job;  // A job was queued
+  std::condition_variable d_cv_done; // A job completed
+  std::thread d_thread;
+
+  void push(job &&j);
+  /** @brief Queue the active buffer of a stream, if it holds anything */
+  void submit(size_t s);
+  void writer_loop();
+  void run(const job &j);
+
+public:
+  /**
+   * @param nstreams Number of independent files
+   * @param buffer_size Bytes per buffer (a multiple of WRITER_ALIGNMENT)
+   */
+  explicit stream_writer(size_t nstreams,
+                         size_t buffer_size = WRITER_BUFFER_SIZE);
+  /** @brief Flushes and closes every file */
+  ~stream_writer();
+
+  stream_writer(const stream_writer &) = delete;
+  stream_writer &operator=(const stream_writer &) = delete;
+
+  /**
+   * @brief Write the next data of a stream to path
+   *
+   * What was written before still goes to the previous file, which is
+   * closed. The file is created (truncated) by the writer thread.
+   */
+  void open(size_t s, std::string path);
+
+  /** @brief Flush and close the file of a stream */
+  void close(size_t s);
+
+  /**
+   * @brief Append data to a stream
+   *
+   * Only copies to the active buffer, unless the writer thread still holds
+   * the other one when it fills up.
+   */
+  void write(size_t s, const void *data, size_t bytes);
+
+  /** @brief Wait until everything queued so far is on its file */
+  void flush();
+
+  /** @brief Bytes given to the current file of a stream */
+  uint64_t bytes(size_t s) const { return d_streams[s].bytes; }
+
+  /** @brief Failed open or write calls since the start */
+  uint64_t errors();
+
+  size_t size() const { return d_streams.size(); }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_STREAM_WRITER_H */
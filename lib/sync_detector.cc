@@ -0,0 +1,433 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sync_detector.h"
+#include "async_logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+
+namespace gr {
+namespace first_lora {
+
+static float realmod(float x, float y) {
+  float result = fmod(x, y);
+  return result >= 0 ? result : result + y;
+}
+
+sync_detector::sync_detector(uint8_t sf, uint32_t bw, uint32_t fs,
+                             uint32_t padding, uint32_t max_peaks,
+                             uint32_t hop)
+    : d_sf(sf), d_max_peaks(max_peaks), d_hop(hop) {
+  if (fs < bw || fs % bw != 0) {
+    throw std::invalid_argument(
+        "sync_detector: sampling rate must be a multiple of the bandwidth");
+  }
+  if (max_peaks < 1 || max_peaks > MAX_PEAKS) {
+    throw std::invalid_argument(
+        "sync_detector: max_peaks must be between 1 and MAX_PEAKS");
+  }
+  if (hop < 1 || hop > MAX_HOP || (hop & (hop - 1)) != 0) {
+    throw std::invalid_argument(
+        "sync_detector: hop must be a power of two up to MAX_HOP");
+  }
+  if (hop > 1 && max_peaks > 1) {
+    throw std::invalid_argument(
+        "sync_detector: hop and max_peaks cannot both be above 1");
+  }
+  d_sps = 1 << d_sf;
+  d_os = fs / bw;
+  d_sn = d_os * d_sps;
+  d_fft_size = padding * d_sn;
+  d_bin_size = PEAK_RESOLUTION * d_sps;
+  // At 1x there is no second image to fold: a timing offset of half a
+  // sample puts a phase jump of pi at the chirp wrap, which splits the peak
+  // in two lobes 1.4 bin apart until the preamble is aligned
+  d_max_distance = d_os == 1 ? 1.5f * MAX_DISTANCE : MAX_DISTANCE;
+
+  // FFT plan and scratch buffers, reused for every symbol. The engine reports
+  // its peaks on the tracker resolution.
+  d_chirps = get_chirp_table(d_sf, bw, fs);
+  d_engine = std::make_unique<dechirp_engine>(d_sn, d_fft_size, padding * d_sps,
+                                              d_chirps, d_bin_size);
+  if (d_hop > 1) {
+    d_coarse = std::make_unique<dechirp_engine>(d_sn, d_os * d_sps, d_sps,
+                                                d_chirps, d_bin_size);
+  }
+  d_peak_separation = PEAK_SEPARATION * padding / PEAK_RESOLUTION;
+
+  // One histogram bin per symbol value
+  d_stats.peak_bins = d_sps;
+  d_stats.peak_hist.reset(new std::atomic<uint64_t>[d_sps]());
+}
+
+void sync_stats::reset() {
+  for (auto *c :
+       {&symbols, &ffts, &preambles, &sfd_found, &sfd_failed, &detections}) {
+    c->store(0, std::memory_order_relaxed);
+  }
+  for (auto &c : state_ns) {
+    c.store(0, std::memory_order_relaxed);
+  }
+  for (uint32_t i = 0; i < peak_bins; i++) {
+    peak_hist[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+float sync_detector::distance(float a, float b) const {
+  float distance = realmod(a - b, d_bin_size);
+  if (distance > (float)d_bin_size / 2) {
+    distance = d_bin_size - distance;
+  }
+  return distance;
+}
+
+void sync_detector::track(uint32_t npeaks) {
+  d_next.clear();
+  for (auto &c : d_candidates) {
+    c.peak = -1;
+  }
+  for (uint32_t i = 0; i < npeaks; i++) {
+    float bin = d_peaks[i].idx;
+    preamble_candidate *best = nullptr;
+    for (auto &c : d_candidates) {
+      // Past its preamble, a candidate only sees noise around its bin
+      if (c.peak < 0 && c.count > 0 && distance(bin, c.bin) <= d_max_distance &&
+          (!c.sfd || (d_peaks[i].val >= SFD_MIN_RATIO * c.val &&
+                      d_peaks[i].val * SFD_MIN_RATIO <= c.val)) &&
+          (best == nullptr || c.count > best->count)) {
+        best = &c;
+      }
+    }
+    uint32_t count = 1;
+    float val = d_peaks[i].val;
+    if (best != nullptr) {
+      best->peak = i;
+      count = best->count + 1;
+      // The window across the end of the preamble sees a part of it only
+      val = std::max(val, best->val);
+      if (best->sfd) {
+        // Still in its preamble, the bin found at the lock is kept
+        best->count = count;
+        best->val = val;
+        continue;
+      }
+    }
+    d_next.push_back({bin, val, count, (int)i, false, 0, 0, 0, -1, 0});
+  }
+  // The candidates searching their SFD stay without peak, to be matched
+  // with the downchirps. Their preamble peak may be gone already.
+  for (auto &c : d_candidates) {
+    if (c.sfd) {
+      d_next.push_back(c);
+    }
+  }
+  std::swap(d_candidates, d_next);
+}
+
+template <typename T> int sync_detector::detect_preamble(const T *in) {
+  int num_consumed = d_sn / d_hop;
+  // Check if peak is above threshold, in as many overlapping windows as it
+  // takes to span MIN_PREAMBLE_CHIRPS symbols
+  if (d_candidates.empty() ||
+      d_candidates[0].count < (MIN_PREAMBLE_CHIRPS - 1) * d_hop + 1) {
+    d_phase = (d_phase + num_consumed) % d_sn;
+    return num_consumed;
+  }
+
+  log_info("sync_detector", "Detected preamble");
+  sync_stats::add(d_stats.preambles);
+  d_state = 2;
+  float bin = d_candidates[0].bin;
+  if (d_hop > 1) {
+    // Align with the precision of the padded FFT
+    bin = d_engine->dechirp(in, true, d_phase).second;
+    sync_stats::add(d_stats.ffts);
+  }
+  // Move preamble peak to bin zero. The peak is relative to the reference
+  // chirp, which starts d_phase samples before the window.
+  num_consumed =
+      (2 * d_sn - (uint32_t)(d_os * bin / PEAK_RESOLUTION) - d_phase) % d_sn;
+  if (num_consumed == 0) {
+    num_consumed = d_sn;
+  }
+  log_debug("sync_detector", "Preamble of {} windows at bin {}",
+            d_candidates[0].count, bin);
+
+  return num_consumed;
+}
+
+int sync_detector::detect_sfd(const dechirp_engine::dual_peak &peaks) {
+  int num_consumed = d_sn;
+  d_detected = false;
+
+  // The preamble, aligned on bin zero, may go on for a few symbols when it
+  // was detected early: up to SFD_MAX_ALIGNED of them do not count towards
+  // the recovery, so a carrier at the preamble bin is given up all the same
+  float aligned = std::min(peaks.up_idx, d_bin_size - peaks.up_idx);
+  bool preamble =
+      aligned <= d_max_distance && d_sfd_aligned++ < SFD_MAX_ALIGNED;
+  if (!preamble && d_sfd_recovery++ > 5) {
+    d_state = 0;
+    sync_stats::add(d_stats.sfd_failed);
+    log_info("sync_detector", "SFD recovery failed");
+    return 0;
+  }
+
+  float up_val = peaks.up_val;
+  float down_val = peaks.down_val;
+  // If absolute value of down_val is greater then we are in the sfd
+  if (abs(up_val) >= abs(down_val)) {
+    return num_consumed;
+  }
+
+  log_info("sync_detector", "SFD detected");
+  sync_stats::add(d_stats.sfd_found);
+  log_debug("sync_detector", "Up: {} Down: {}", up_val, down_val);
+
+  num_consumed = round(1.25 * d_sn);
+
+  d_state = 3;
+  return num_consumed;
+}
+
+int64_t sync_detector::sfd_window(const preamble_candidate &c, float first,
+                                  float second) const {
+  // The symbols of the packet start phase samples before those of the
+  // windows. The window after the first one to see the downchirps is full
+  // of them. So they start in the last symbol of the first window when its
+  // peak is weaker, by as much, else less than half a symbol before it (the
+  // window before, if any, was lost in the noise). The window of a
+  // detection starts 1.25 symbols after that, less the 12 symbols before.
+  int64_t phase = (int64_t)(d_os * c.bin / PEAK_RESOLUTION);
+  float fill = std::min(1.0f, first / second);
+  float expected = fill < SFD_FULL_RATIO ? (1 - fill) * d_sn : -0.25f * d_sn;
+  int64_t down = (d_sn - phase) % d_sn;
+  if (down - expected > d_sn / 2) {
+    down -= d_sn;
+  }
+  return down + (int64_t)std::lround(1.25 * d_sn);
+}
+
+void sync_detector::step_candidates(const dechirp_engine::dual_peak &peaks,
+                                    uint32_t npeaks) {
+  track(npeaks);
+
+  // Preamble found: look for its SFD, as long as it can be told apart
+  uint32_t searching = 0;
+  for (const auto &c : d_candidates) {
+    searching += c.sfd;
+  }
+  for (auto &c : d_candidates) {
+    if (!c.sfd && c.count >= MIN_PREAMBLE_CHIRPS &&
+        searching < d_max_peaks) {
+      log_info("sync_detector", "Detected preamble");
+      log_debug("sync_detector", "Preamble at bin {}", c.bin);
+      sync_stats::add(d_stats.preambles);
+      c.sfd = true;
+      c.recovery = 0;
+      c.aligned = 0;
+      c.order = d_preambles++;
+      searching++;
+    }
+  }
+
+  // The rest of an SFD found is not the SFD of another packet
+  bool taken = false;
+  for (auto &f : d_sfds) {
+    taken |= d_state == 2 && distance(peaks.down_idx, f.first) <= d_max_distance;
+    f.second--;
+  }
+  d_sfds.erase_if(
+      [](const std::pair<float, int> &f) { return f.second <= 0; });
+
+  // The downchirp goes to the oldest preamble that is over, if it is about
+  // as strong. It cannot be compared to the upchirps as with a single
+  // preamble: the SFD of a weak packet can come under the payload of a
+  // strong one, which also leaves downchirp peaks about as strong. The two
+  // downchirps show at the same bin in two windows in a row, the noise of
+  // the payload does not. Only a step with dechirp_dual() has a downchirp.
+  preamble_candidate *sfd = nullptr;
+  for (auto &c : d_candidates) {
+    if (!c.sfd) {
+      continue;
+    }
+    bool preamble = c.peak >= 0 && c.aligned++ < SFD_MAX_ALIGNED;
+    if (!preamble && c.recovery++ > 5) {
+      c.count = 0; // SFD recovery failed, dropped below
+      sync_stats::add(d_stats.sfd_failed);
+      log_info("sync_detector", "SFD recovery failed");
+      continue;
+    }
+    if (d_state != 2 || taken || c.peak >= 0 ||
+        (sfd != nullptr && sfd->order < c.order)) {
+      continue;
+    }
+    if (peaks.down_val >= SFD_MIN_RATIO * c.val &&
+        peaks.down_val * SFD_MIN_RATIO <= c.val) {
+      sfd = &c;
+    }
+  }
+  for (auto &c : d_candidates) {
+    if (&c != sfd) {
+      c.down = -1;
+    }
+  }
+
+  if (sfd != nullptr) {
+    // The downchirps start in the first window that saw them at this bin:
+    // the previous one, even below the ratio when they only begin in it, or
+    // this one, to be confirmed by the next
+    float first = -1;
+    if (sfd->down >= 0 &&
+        distance(peaks.down_idx, sfd->down) <= d_max_distance) {
+      first = sfd->down_val;
+    } else if (d_prev_down.val > 0 &&
+               distance(peaks.down_idx, d_prev_down.idx) <= d_max_distance) {
+      first = d_prev_down.val;
+    }
+    if (first > 0) {
+      log_info("sync_detector", "SFD detected");
+      sync_stats::add(d_stats.sfd_found);
+      // From the window of the next step, one symbol later
+      d_pending.push_back(sfd_window(*sfd, first, peaks.down_val) - d_sn);
+      // The rest of its downchirps is seen by the next windows
+      d_sfds.push_back({(float)peaks.down_idx, 2});
+      sfd->count = 0;
+    } else {
+      sfd->down = peaks.down_idx;
+      sfd->down_val = peaks.down_val;
+    }
+  }
+  d_prev_down = {d_state == 2 ? peaks.down_val : 0, peaks.down_idx};
+
+  // Drop the candidates done with
+  d_candidates.erase_if(
+      [](const preamble_candidate &c) { return c.count == 0; });
+  d_state = 1;
+  for (const auto &c : d_candidates) {
+    if (c.sfd) {
+      d_state = 2;
+    }
+  }
+}
+
+std::unique_ptr<dechirp_engine> sync_detector::make_search_engine() const {
+  const dechirp_engine &e = d_hop > 1 ? *d_coarse : *d_engine;
+  return std::make_unique<dechirp_engine>(e.sn(), e.fft_size(), e.bin_size(),
+                                          d_chirps, e.peak_bins());
+}
+
+template <typename T>
+dechirp_engine::spectrum_peak
+sync_detector::search_peak(dechirp_engine &engine, const T *in,
+                           uint32_t ahead) const {
+  // The reference phase moves on with the windows, see detect_preamble()
+  engine.set_peak_method(d_engine->get_peak_method());
+  auto peak = engine.dechirp(
+      in, true, (d_phase + (uint64_t)ahead * search_step()) % d_sn);
+  return {peak.first, peak.second};
+}
+
+template <typename T>
+uint32_t sync_detector::step(const T *in,
+                             const dechirp_engine::spectrum_peak *ahead) {
+  uint32_t num_consumed = d_sn;
+  d_detected = false;
+  d_detection_offset = 0;
+  int state = d_state;
+  const auto start = std::chrono::steady_clock::now();
+
+  // A window found by a previous SFD is output once it is in the buffer
+  if (!d_pending.empty() && d_pending.front() <= 0) {
+    d_detected = true;
+    d_detection_offset = d_pending.front();
+    d_pending.pop_front();
+    sync_stats::add(d_stats.detections);
+    state = 3;
+  }
+
+  // Dechirp. While looking for the SFD, the downchirp peak of the same symbol
+  // comes out of the same pass.
+  dechirp_engine::dual_peak peaks = {0, 0, 0, 0};
+  if (d_state == 2) {
+    peaks = d_engine->dechirp_dual(in);
+    sync_stats::add(d_stats.ffts, 2);
+  } else if (ahead != nullptr && searching()) {
+    peaks.up_val = ahead->val;
+    peaks.up_idx = ahead->idx;
+    sync_stats::add(d_stats.ffts);
+  } else if (d_state == 1 && d_hop > 1) {
+    // The hop windows only follow the preamble, without padding
+    d_coarse->set_peak_method(d_engine->get_peak_method());
+    std::tie(peaks.up_val, peaks.up_idx) = d_coarse->dechirp(in, true, d_phase);
+    sync_stats::add(d_stats.ffts);
+  } else {
+    std::tie(peaks.up_val, peaks.up_idx) = d_engine->dechirp(in, true);
+    sync_stats::add(d_stats.ffts);
+  }
+  sync_stats::add(d_stats.symbols);
+  sync_stats::add(d_stats.peak_hist[peaks.up_idx / PEAK_RESOLUTION]);
+  d_max_val = peaks.up_val;
+
+  if (d_max_peaks > 1) {
+    uint32_t npeaks = d_engine->find_peaks(d_max_peaks, d_peak_separation,
+                                           PEAK_MIN_RATIO, d_peaks.data());
+    step_candidates(peaks, npeaks);
+    for (auto &p : d_pending) {
+      p -= num_consumed;
+    }
+  } else {
+    d_peaks[0] = {peaks.up_val, peaks.up_idx};
+    track(1);
+
+    switch (d_state) {
+    case 0: // Reset state
+      d_candidates.clear();
+      d_sfd_recovery = 0;
+      d_sfd_aligned = 0;
+      d_phase = 0;
+      d_state = 1;
+      break;
+    case 1: // Preamble
+      num_consumed = detect_preamble(in);
+      break;
+    case 2: // SFD
+      num_consumed = detect_sfd(peaks);
+      break;
+    case 3: // Output signal
+      d_detected = true;
+      sync_stats::add(d_stats.detections);
+      d_state = 0;
+      break;
+    }
+  }
+
+  sync_stats::add(d_stats.state_ns[state],
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count());
+  return num_consumed;
+}
+
+// The sample types of the input of a detector
+template uint32_t sync_detector::step(const gr_complex *,
+                                      const dechirp_engine::spectrum_peak *);
+template uint32_t sync_detector::step(const lv_16sc_t *,
+                                      const dechirp_engine::spectrum_peak *);
+template dechirp_engine::spectrum_peak
+sync_detector::search_peak(dechirp_engine &, const gr_complex *,
+                           uint32_t) const;
+template dechirp_engine::spectrum_peak
+sync_detector::search_peak(dechirp_engine &, const lv_16sc_t *,
+                           uint32_t) const;
+
+} /* namespace first_lora */
+} /* namespace gr */
@@ -0,0 +1,299 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_SYNC_DETECTOR_H
+#define INCLUDED_FIRST_LORA_SYNC_DETECTOR_H
+
+#include "dechirp_engine.h"
+#include "fixed_ring.h"
+
+#include <gnuradio/first_lora/api.h>
+#include <gnuradio/gr_complex.h>
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#define MIN_PREAMBLE_CHIRPS 6
+#define MAX_DISTANCE 10
+#define DEMOD_HISTORY (8 + 5)
+// Peak bins per symbol bin seen by the preamble tracker, whatever the padding
+#define PEAK_RESOLUTION 10
+#define SYNC_STATES 4 // Reset, preamble, SFD, output
+#define MAX_PEAKS 8   // Most peaks tracked per symbol
+// Tracker bins between two peaks of a symbol, past the main lobe of each
+#define PEAK_SEPARATION (3 * PEAK_RESOLUTION)
+// Weakest peak tracked, relative to the strongest of the symbol. Above the
+// first side lobe (-13 dB) of the strongest peak.
+#define PEAK_MIN_RATIO 0.25f
+// Weakest SFD downchirp, relative to the upchirps of its preamble, when the
+// candidates search their SFD on their own (max_peaks > 1)
+#define SFD_MIN_RATIO 0.5f
+// Downchirp peak of a window full of the SFD, relative to the next one
+#define SFD_FULL_RATIO 0.8f
+// Symbols of the aligned preamble let through after its detection, before
+// they count towards the SFD recovery like the others
+#define SFD_MAX_ALIGNED 8
+#define MAX_HOP 8 // Most windows per symbol of the preamble search
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Counters of a sync_detector
+ *
+ * Only the detector thread writes them, any thread can read them. Updates
+ * are relaxed load/store pairs rather than read-modify-write, a reset that
+ * races with the detector may lose the increments in flight.
+ */
+struct sync_stats {
+  std::atomic<uint64_t> symbols{0};    // Symbols stepped through
+  std::atomic<uint64_t> ffts{0};       // FFTs executed
+  std::atomic<uint64_t> preambles{0};  // Preambles found
+  std::atomic<uint64_t> sfd_found{0};  // SFDs found after a preamble
+  std::atomic<uint64_t> sfd_failed{0}; // SFD searches given up
+  std::atomic<uint64_t> detections{0}; // Packets output
+  std::atomic<uint64_t> state_ns[SYNC_STATES] = {}; // Time spent per state
+  std::unique_ptr<std::atomic<uint64_t>[]> peak_hist; // Upchirp peaks per bin
+  uint32_t peak_bins = 0;                             // Bins of peak_hist
+
+  static void add(std::atomic<uint64_t> &c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  void reset();
+};
+
+/**
+ * @brief Preamble / SFD state machine (method 1) for one spreading factor
+ *
+ * Works on a caller owned sample buffer: step() looks at one symbol and
+ * tells how many samples to advance, so several detectors (one per SF) can
+ * walk the same input.
+ *
+ * With max_peaks above 1, the strongest peaks of each symbol are tracked as
+ * as many candidate preambles, so the preamble of a packet colliding with
+ * another one of the same SF (at another time and frequency offset) is
+ * found too. The window is then never moved onto a preamble: each candidate
+ * searches its SFD on its own, at the offset its peak gives, and the window
+ * of a detection is reported through detection_offset(). Every step()
+ * consumes one symbol.
+ *
+ * With hop above 1 (max_peaks 1 only), the preamble search moves by
+ * 1/hop symbol instead of one, so a preamble is found and aligned on up to
+ * a symbol earlier. The reference chirp keeps the phase of the first window
+ * of the search, so overlapping windows see a preamble at the same bin, and
+ * these windows use an FFT without padding (the peak is interpolated). The
+ * padded FFT is only run again to align on the preamble found.
+ *
+ * The windows of the preamble search (max_peaks 1) do not depend on each
+ * other until a preamble is found, so their peaks can be computed ahead, on
+ * other threads, with search_peak() and handed to step().
+ */
+class FIRST_LORA_API sync_detector {
+private:
+  /**
+   * @brief Candidate preamble: a peak seen at the same bin symbol after
+   * symbol
+   */
+  struct preamble_candidate {
+    float bin;         // Peak of the last symbol (tracker bins)
+    float val;         // Largest peak value of the preamble
+    uint32_t count;    // Consecutive symbols with a peak within d_max_distance
+    int peak;          // Peak of this symbol that continued it, -1 if none
+    bool sfd;          // Preamble found, searching the SFD (max_peaks > 1)
+    int recovery;      // SFD search symbols without the preamble peak
+    int aligned;       // SFD search symbols with the preamble peak
+    uint64_t order;    // Order in which the preambles were found
+    float down;        // Down bin of an SFD to confirm, -1 if none
+    float down_val;    // Its peak value
+  };
+
+  uint8_t d_sf;                   // Spreading factor
+  uint32_t d_sps;                 // Samples per symbol (2^sf)
+  uint32_t d_os;                  // Oversampling factor (fs / bw)
+  uint32_t d_sn;                  // Number of samples (d_os * d_sps)
+  uint32_t d_fft_size;            // FFT size
+  uint32_t d_bin_size;            // Tracker bins (PEAK_RESOLUTION * d_sps)
+  float d_max_distance;           // Preamble peak tolerance (tracker bins)
+  uint32_t d_max_peaks;           // Peaks tracked per symbol
+  uint32_t d_peak_separation;     // PEAK_SEPARATION in FFT bins
+  std::shared_ptr<const chirp_table> d_chirps; // Reference chirps
+  std::unique_ptr<dechirp_engine> d_engine; // Dechirp plan and scratch
+  std::unique_ptr<dechirp_engine> d_coarse; // Unpadded FFT of the hop windows
+  uint32_t d_hop;                 // Windows per symbol of the preamble search
+  uint32_t d_phase = 0;           // Start of the window in the reference chirp
+  std::array<dechirp_engine::spectrum_peak, MAX_PEAKS> d_peaks; // Peaks of
+                                                                // the symbol
+  // Each peak of a symbol continues or starts a candidate, and at most
+  // max_peaks more search their SFD
+  fixed_ring<preamble_candidate, 2 * MAX_PEAKS> d_candidates; // Tracked,
+                                                              // strongest first
+  fixed_ring<preamble_candidate, 2 * MAX_PEAKS> d_next; // Being updated
+  // At most one SFD is found per step, and output at the next one
+  fixed_ring<int64_t, MAX_PEAKS> d_pending; // Window starts of the SFDs
+                                            // found, from the window of the
+                                            // next step()
+  fixed_ring<std::pair<float, int>, MAX_PEAKS> d_sfds; // Down bin of the
+                                                       // SFDs found and
+                                                       // symbols left in them
+  dechirp_engine::spectrum_peak d_prev_down = {0, 0}; // Downchirp peak of
+                                                      // the last dual step
+  uint64_t d_preambles = 0;       // Preambles found (candidate order)
+  int64_t d_detection_offset = 0; // Window of the detection, see accessor
+  float d_max_val = 0;            // Maximum value of the FFT
+  int d_sfd_recovery = 0;         // SFD recovery count
+  int d_sfd_aligned = 0;          // SFD search symbols at the preamble bin
+  bool d_detected = false;        // Detected LoRa signal
+  int d_state = 0;                // State of the detector
+  sync_stats d_stats;             // Counters
+
+  /** @brief Distance between two tracker bins, around the circle */
+  float distance(float a, float b) const;
+
+  /**
+   * @brief Match the peaks of the symbol with the candidates
+   * Each peak, strongest first, continues the longest candidate close
+   * enough that no other peak continued. The other candidates are dropped,
+   * unless they are searching their SFD.
+   * @param npeaks Number of peaks in d_peaks
+   */
+  void track(uint32_t npeaks);
+
+  /**
+   * @brief Preamble search (max_peaks 1)
+   * @param in Last symbol of the window, to align on the preamble found
+   * @return Number of samples to consume
+   */
+  template <typename T> int detect_preamble(const T *in);
+
+  int detect_sfd(const dechirp_engine::dual_peak &peaks);
+
+  /**
+   * @brief Window of a detection, from the two windows in a row seeing the
+   * SFD of a candidate
+   * @param c Candidate of the SFD
+   * @param first Downchirp peak of the first window
+   * @param second Downchirp peak of the second window
+   * @return Start of the window of the detection, in samples from the first
+   *         window
+   */
+  int64_t sfd_window(const preamble_candidate &c, float first,
+                     float second) const;
+
+  /**
+   * @brief One symbol of the candidate preambles (max_peaks > 1)
+   * @param peaks Peaks of dechirp_dual() while an SFD is searched
+   * @param npeaks Number of peaks in d_peaks
+   */
+  void step_candidates(const dechirp_engine::dual_peak &peaks,
+                       uint32_t npeaks);
+
+public:
+  /**
+   * @param sf Spreading factor
+   * @param bw Bandwidth
+   * @param fs Sampling rate, a multiple of bw. At fs = bw the FFT is half
+   *           the size of the 2x one and the CPA/FPA fold has nothing to add.
+   * @param padding Zero-padding factor of the FFT. Below PEAK_RESOLUTION the
+   *                peak is interpolated between bins.
+   * @param max_peaks Peaks tracked per symbol, 1 to MAX_PEAKS. Above 1 each
+   *                  symbol costs one more pass over the folded spectrum
+   *                  per peak.
+   * @param hop Windows per symbol of the preamble search, a power of two up
+   *            to MAX_HOP. Above 1, max_peaks must be 1.
+   */
+  sync_detector(uint8_t sf, uint32_t bw, uint32_t fs,
+                uint32_t padding = PEAK_RESOLUTION, uint32_t max_peaks = 1,
+                uint32_t hop = 1);
+
+  /**
+   * @brief Run the state machine on one symbol
+   * @param in Symbol to process (last symbol of the DEMOD_HISTORY window),
+   *           gr_complex or complex int16 (lv_16sc_t) samples
+   * @param ahead Peak of this window from search_peak(), used instead of
+   *              dechirping it while searching() (NULL: dechirp it)
+   * @return Number of samples to consume
+   */
+  template <typename T>
+  uint32_t step(const T *in,
+                const dechirp_engine::spectrum_peak *ahead = nullptr);
+
+  /**
+   * @brief Whether the next step() is a preamble search window, which
+   * search_peak() can compute ahead
+   *
+   * Every step() consumes search_step() samples as long as this holds.
+   */
+  bool searching() const { return d_max_peaks == 1 && d_state == 1; }
+
+  /** @brief Samples between two windows of the preamble search */
+  uint32_t search_step() const { return d_sn / d_hop; }
+
+  /**
+   * @brief Engine for search_peak(), one per thread computing windows
+   */
+  std::unique_ptr<dechirp_engine> make_search_engine() const;
+
+  /**
+   * @brief Peak of a preamble search window, as step() would dechirp it
+   *
+   * Only reads the detector, so distinct engines can run on several threads
+   * while step() is not called.
+   * @param engine Engine from make_search_engine()
+   * @param in Symbol of the window (as passed to step())
+   * @param ahead Windows between the next step() and this one
+   */
+  template <typename T>
+  dechirp_engine::spectrum_peak search_peak(dechirp_engine &engine,
+                                            const T *in, uint32_t ahead) const;
+
+  /** @brief Whether the last step() completed a detection */
+  bool detected() const { return d_detected; }
+
+  /**
+   * @brief Start of the detected window, in samples from the window of the
+   * last step() (0 or less, 0 with max_peaks 1)
+   *
+   * Above -max_lag(), unless several packets end their SFD together: the
+   * windows found wait their turn, a symbol more each.
+   */
+  int64_t detection_offset() const { return d_detection_offset; }
+
+  /** @brief Largest number of samples a single step() can consume */
+  uint32_t max_step() const { return (uint32_t)std::ceil(1.25 * d_sn); }
+
+  /**
+   * @brief Samples to keep before the window of a step() for the window of
+   * its detection
+   *
+   * An SFD is confirmed by the window after the first one to see it, and
+   * output at the step after that: its window starts up to 1.5 symbols
+   * before the window of that step (see sfd_window()).
+   */
+  uint32_t max_lag() const {
+    return d_max_peaks > 1 ? (uint32_t)std::ceil(1.5 * d_sn) : 0;
+  }
+
+  uint8_t sf() const { return d_sf; }
+  uint32_t sn() const { return d_sn; }
+  uint32_t os() const { return d_os; }
+  uint32_t bin_size() const { return d_bin_size; }
+  uint32_t max_peaks() const { return d_max_peaks; }
+  uint32_t hop() const { return d_hop; }
+  int state() const { return d_state; }
+  float max_val() const { return d_max_val; }
+  dechirp_engine &engine() { return *d_engine; }
+  sync_stats &stats() { return d_stats; }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_SYNC_DETECTOR_H */
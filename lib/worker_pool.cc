@@ -0,0 +1,95 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "worker_pool.h"
+
+namespace gr {
+namespace first_lora {
+
+worker_pool::worker_pool(unsigned nthreads) {
+  if (nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency();
+  }
+  // The caller is one of the threads
+  for (unsigned i = 1; i < nthreads; i++) {
+    d_threads.emplace_back(&worker_pool::worker_loop, this);
+  }
+}
+
+worker_pool::~worker_pool() {
+  {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    d_stop = true;
+  }
+  d_cv_start.notify_all();
+  for (auto &t : d_threads) {
+    t.join();
+  }
+}
+
+void worker_pool::drain(void (*fn)(void *, size_t), void *ctx, size_t n) {
+  size_t i;
+  while ((i = d_next.fetch_add(1, std::memory_order_relaxed)) < n) {
+    fn(ctx, i);
+  }
+}
+
+void worker_pool::run(size_t n, void (*fn)(void *, size_t), void *ctx) {
+  if (d_threads.empty() || n <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      fn(ctx, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    d_fn = fn;
+    d_ctx = ctx;
+    d_n = n;
+    d_next.store(0, std::memory_order_relaxed);
+    d_active = d_threads.size();
+    d_generation++;
+  }
+  d_cv_start.notify_all();
+
+  drain(fn, ctx, n);
+
+  std::unique_lock<std::mutex> lock(d_mutex);
+  d_cv_done.wait(lock, [this] { return d_active == 0; });
+}
+
+void worker_pool::worker_loop() {
+  uint64_t seen = 0;
+  for (;;) {
+    void (*fn)(void *, size_t);
+    void *ctx;
+    size_t n;
+    {
+      std::unique_lock<std::mutex> lock(d_mutex);
+      d_cv_start.wait(lock,
+                      [this, seen] { return d_stop || d_generation != seen; });
+      if (d_stop) {
+        return;
+      }
+      seen = d_generation;
+      fn = d_fn;
+      ctx = d_ctx;
+      n = d_n;
+    }
+
+    drain(fn, ctx, n);
+
+    std::lock_guard<std::mutex> lock(d_mutex);
+    if (--d_active == 0) {
+      d_cv_done.notify_one();
+    }
+  }
+}
+
+} /* namespace first_lora */
+} /* namespace gr */
@@ -0,0 +1,77 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2024 kazawai.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef INCLUDED_FIRST_LORA_WORKER_POOL_H
+#define INCLUDED_FIRST_LORA_WORKER_POOL_H
+
+#include <gnuradio/first_lora/api.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gr {
+namespace first_lora {
+
+/**
+ * @brief Fixed set of threads running parallel_for() jobs
+ *
+ * The calling thread takes part in every job, so a pool of size 1 has no
+ * extra thread and runs everything inline. Dispatching a job does not
+ * allocate.
+ */
+class FIRST_LORA_API worker_pool {
+private:
+  std::vector<std::thread> d_threads;
+  std::mutex d_mutex;
+  std::condition_variable d_cv_start; // A new job is available
+  std::condition_variable d_cv_done;  // All workers left the current job
+  uint64_t d_generation = 0;          // Job counter
+  bool d_stop = false;
+  void (*d_fn)(void *, size_t) = nullptr; // Current job
+  void *d_ctx = nullptr;                  // Current job context
+  size_t d_n = 0;                         // Current job size
+  std::atomic<size_t> d_next{0};          // Next index to run
+  unsigned d_active = 0;                  // Workers still in the job
+
+  void run(size_t n, void (*fn)(void *, size_t), void *ctx);
+  void drain(void (*fn)(void *, size_t), void *ctx, size_t n);
+  void worker_loop();
+
+public:
+  /**
+   * @param nthreads Number of threads, caller included (0: one per core)
+   */
+  explicit worker_pool(unsigned nthreads = 0);
+  ~worker_pool();
+
+  worker_pool(const worker_pool &) = delete;
+  worker_pool &operator=(const worker_pool &) = delete;
+
+  /** @brief Number of threads taking part in a job, caller included */
+  unsigned size() const { return d_threads.size() + 1; }
+
+  /**
+   * @brief Call f(i) for every i in [0, n) and wait for all of them
+   */
+  template <typename F> void parallel_for(size_t n, F &&f) {
+    using fn_t = std::remove_reference_t<F>;
+    run(
+        n, [](void *ctx, size_t i) { (*static_cast<fn_t *>(ctx))(i); },
+        (void *)&f);
+  }
+};
+
+} // namespace first_lora
+} // namespace gr
+
+#endif /* INCLUDED_FIRST_LORA_WORKER_POOL_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+/***********************************************************************************/
+/* This file is automatically generated using bindtool and can be manually
+ * edited  */
+/* The following lines can be configured to regenerate this file during cmake */
+/* If manual edits are made, the following tags should be modified accordingly.
+ */
+/* BINDTOOL_GEN_AUTOMATIC(0) */
+/* BINDTOOL_USE_PYGCCXML(0) */
+/* BINDTOOL_HEADER_FILE(channelized_detector.h) */
+/* BINDTOOL_HEADER_FILE_HASH(7f52715c2d05f2a5a97c4e63ad20e39f) */
+/***********************************************************************************/
+
+#include <pybind11/complex.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+#include <gnuradio/first_lora/channelized_detector.h>
+// pydoc.h is automatically generated in the build directory
+#include <channelized_detector_pydoc.h>
+
+void bind_channelized_detector(py::module &m) {
+
+  using channelized_detector = ::gr::first_lora::channelized_detector;
+
+  py::class_<channelized_detector, gr::block, gr::basic_block,
+             std::shared_ptr<channelized_detector>>(m, "channelized_detector",
+                                                    D(channelized_detector))
+
+      .def(py::init(&channelized_detector::make), py::arg("sf") = 7,
+           py::arg("bw") = 125000, py::arg("samp_rate") = 1600000,
+           py::arg("nchannels") = 8,
+           py::arg("channels") = std::vector<int>(), py::arg("method") = 1,
+           py::arg("nthreads") = 0, D(channelized_detector, make))
+
+      ;
+}
@@ -20,3 +20,13 @@ static const char *__doc_gr_first_lora_lora_detector_lora_detector =
     R"doc()doc";
 
 static const char *__doc_gr_first_lora_lora_detector_make = R"doc()doc";
+
+static const char *__doc_gr_first_lora_lora_detector_stats = R"doc()doc";
+
+static const char *__doc_gr_first_lora_lora_detector_peak_histogram =
+    R"doc()doc";
+
+static const char *__doc_gr_first_lora_lora_detector_reset_stats = R"doc()doc";
+
+static const char *__doc_gr_first_lora_lora_detector_set_stats_interval =
+    R"doc()doc";
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+/***********************************************************************************/
+/* This file is automatically generated using bindtool and can be manually
+ * edited  */
+/* The following lines can be configured to regenerate this file during cmake */
+/* If manual edits are made, the following tags should be modified accordingly.
+ */
+/* BINDTOOL_GEN_AUTOMATIC(0) */
+/* BINDTOOL_USE_PYGCCXML(0) */
+/* BINDTOOL_HEADER_FILE(log.h) */
+/* BINDTOOL_HEADER_FILE_HASH(ba90d1c085f5f267f0487a121dd2f8ef) */
+/***********************************************************************************/
+
+#include <pybind11/complex.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+#include <gnuradio/first_lora/log.h>
+// pydoc.h is automatically generated in the build directory
+#include <log_pydoc.h>
+
+void bind_log(py::module &m) {
+
+  py::enum_<::gr::first_lora::log_level>(m, "log_level")
+      .value("debug", ::gr::first_lora::log_level::debug)
+      .value("info", ::gr::first_lora::log_level::info)
+      .value("warning", ::gr::first_lora::log_level::warning)
+      .value("error", ::gr::first_lora::log_level::error)
+      .value("off", ::gr::first_lora::log_level::off);
+
+  m.def("set_log_level", &::gr::first_lora::set_log_level, py::arg("level"),
+        D(set_log_level));
+
+  m.def("get_log_level", &::gr::first_lora::get_log_level, D(get_log_level));
+}
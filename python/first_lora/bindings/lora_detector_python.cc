@@ -16,7 +16,7 @@
 /* BINDTOOL_GEN_AUTOMATIC(0) */
 /* BINDTOOL_USE_PYGCCXML(0) */
 /* BINDTOOL_HEADER_FILE(lora_detector.h) */
-/* BINDTOOL_HEADER_FILE_HASH(d1fded58770aca79409611af6189ba60) */
+/* BINDTOOL_HEADER_FILE_HASH(c28a9360bda5235f211024e909314746) */
 /***********************************************************************************/
 
 #include <pybind11/complex.h>
@@ -40,7 +40,23 @@ void bind_lora_detector(py::module &m) {
       .def(py::init(&lora_detector::make),
            py::arg("threshold") = 0.10000000000000001, py::arg("sf") = 7,
            py::arg("bw") = 125000, py::arg("method") = 0,
+           py::arg("batch") = false, py::arg("padding") = 10,
+           py::arg("output_mode") = 0, py::arg("samp_rate") = 0,
+           py::arg("max_peaks") = 1, py::arg("hop") = 1,
+           py::arg("nthreads") = 1, py::arg("low_latency") = false,
+           py::arg("sc16") = false,
            D(lora_detector, make))
 
+      .def("stats", &lora_detector::stats, D(lora_detector, stats))
+
+      .def("peak_histogram", &lora_detector::peak_histogram,
+           D(lora_detector, peak_histogram))
+
+      .def("reset_stats", &lora_detector::reset_stats,
+           D(lora_detector, reset_stats))
+
+      .def("set_stats_interval", &lora_detector::set_stats_interval,
+           py::arg("seconds"), D(lora_detector, set_stats_interval))
+
       ;
 }
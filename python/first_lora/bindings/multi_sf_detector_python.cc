@@ -0,0 +1,45 @@
+/*
+ * Copyright 2024 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+/***********************************************************************************/
+/* This file is automatically generated using bindtool and can be manually
+ * edited  */
+/* The following lines can be configured to regenerate this file during cmake */
+/* If manual edits are made, the following tags should be modified accordingly.
+ */
+/* BINDTOOL_GEN_AUTOMATIC(0) */
+/* BINDTOOL_USE_PYGCCXML(0) */
+/* BINDTOOL_HEADER_FILE(multi_sf_detector.h) */
+/* BINDTOOL_HEADER_FILE_HASH(6ce40dc1eaaaf77dbe5cd9b111706d4f) */
+/***********************************************************************************/
+
+#include <pybind11/complex.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+#include <gnuradio/first_lora/multi_sf_detector.h>
+// pydoc.h is automatically generated in the build directory
+#include <multi_sf_detector_pydoc.h>
+
+void bind_multi_sf_detector(py::module &m) {
+
+  using multi_sf_detector = ::gr::first_lora::multi_sf_detector;
+
+  py::class_<multi_sf_detector, gr::block, gr::basic_block,
+             std::shared_ptr<multi_sf_detector>>(m, "multi_sf_detector",
+                                                 D(multi_sf_detector))
+
+      .def(py::init(&multi_sf_detector::make), py::arg("sf_min") = 7,
+           py::arg("sf_max") = 12, py::arg("bw") = 125000,
+           py::arg("nthreads") = 0, D(multi_sf_detector, make))
+
+      ;
+}
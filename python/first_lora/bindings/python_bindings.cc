@@ -23,6 +23,10 @@ namespace py = pybind11;
 // BINDING_FUNCTION_PROTOTYPES(
     void bind_mysquare(py::module& m);
     void bind_lora_detector(py::module& m);
+    void bind_multi_sf_detector(py::module& m);
+    void bind_channelized_detector(py::module& m);
+    void bind_sigmf_writer(py::module& m);
+    void bind_log(py::module& m);
 // ) END BINDING_FUNCTION_PROTOTYPES
 
 
@@ -53,5 +57,9 @@ PYBIND11_MODULE(first_lora_python, m)
     // BINDING_FUNCTION_CALLS(
     bind_mysquare(m);
     bind_lora_detector(m);
+    bind_multi_sf_detector(m);
+    bind_channelized_detector(m);
+    bind_sigmf_writer(m);
+    bind_log(m);
     // ) END BINDING_FUNCTION_CALLS
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+/***********************************************************************************/
+/* This file is automatically generated using bindtool and can be manually
+ * edited  */
+/* The following lines can be configured to regenerate this file during cmake */
+/* If manual edits are made, the following tags should be modified accordingly.
+ */
+/* BINDTOOL_GEN_AUTOMATIC(0) */
+/* BINDTOOL_USE_PYGCCXML(0) */
+/* BINDTOOL_HEADER_FILE(sigmf_writer.h) */
+/* BINDTOOL_HEADER_FILE_HASH(94e30abf21af89454c3ec0e1f2e3236c) */
+/***********************************************************************************/
+
+#include <pybind11/complex.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+#include <gnuradio/first_lora/sigmf_writer.h>
+// pydoc.h is automatically generated in the build directory
+#include <sigmf_writer_pydoc.h>
+
+void bind_sigmf_writer(py::module &m) {
+
+  using sigmf_writer = ::gr::first_lora::sigmf_writer;
+
+  py::class_<sigmf_writer, gr::sync_block, gr::block, gr::basic_block,
+             std::shared_ptr<sigmf_writer>>(m, "sigmf_writer", D(sigmf_writer))
+
+      .def(py::init(&sigmf_writer::make), py::arg("filename"),
+           py::arg("author"), py::arg("description"), py::arg("item_size") = 8,
+           py::arg("item_type") = true, py::arg("sample_rate") = 250000,
+           py::arg("frequency") = 868e6, py::arg("hw") = "",
+           py::arg("version") = "0.0.1", py::arg("num_inputs") = 1,
+           py::arg("is_loopback") = false, py::arg("ip_address") = "localhost",
+           py::arg("port") = 12345,
+           D(sigmf_writer, make))
+
+      ;
+}
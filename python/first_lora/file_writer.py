@@ -175,8 +175,12 @@ class file_writer(gr.basic_block):
         self.handle_msg(msg, 2)
 
     def handle_msg(self, msg, port_id):
-        print(f"Received message: {pmt.to_python(msg)} from port {port_id}")
-        if pmt.to_python(msg) == True:
+        msg = pmt.to_python(msg)
+        print(f"Received message: {msg} from port {port_id}")
+        # Detectors publish either True or a dict with a "detected" key
+        if isinstance(msg, dict):
+            msg = msg.get("detected", False)
+        if msg == True:
             self.new_symol[port_id] = True
 
     def _thread_handle_device_id(self):